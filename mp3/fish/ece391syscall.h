@@ -3,6 +3,23 @@
 
 #include <stdint.h>
 
+/* One buffer of a readv or writev. */
+typedef struct ece391_iovec {
+    void* base;
+    int32_t len;
+} ece391_iovec_t;
+
+/* One directory entry from getdents. Entries are packed back to back, reclen
+   bytes apart; the name is NUL terminated. */
+typedef struct ece391_dirent {
+    uint16_t reclen;
+    uint8_t type;
+    uint8_t namelen;
+    uint32_t inode;
+    uint32_t size;
+    char name[1];
+} ece391_dirent_t;
+
 /* All calls return >= 0 on success or -1 on failure. */
 
 /*  
@@ -19,6 +36,23 @@ extern int32_t ece391_open (const uint8_t* filename);
 extern int32_t ece391_close (int32_t fd);
 extern int32_t ece391_getargs (uint8_t* buf, int32_t nbytes);
 extern int32_t ece391_vidmap (uint8_t** screen_start);
+extern int32_t ece391_fork (void);
+extern int32_t ece391_creat (const uint8_t* filename);
+extern int32_t ece391_mmap (int32_t fd, uint8_t** start);
+extern int32_t ece391_munmap (uint8_t* start);
+extern int32_t ece391_readv (int32_t fd, const ece391_iovec_t* iov, int32_t iovcnt);
+extern int32_t ece391_writev (int32_t fd, const ece391_iovec_t* iov, int32_t iovcnt);
+extern int32_t ece391_pread (int32_t fd, void* buf, int32_t nbytes, uint32_t offset);
+extern int32_t ece391_pwrite (int32_t fd, const void* buf, int32_t nbytes, uint32_t offset);
+extern int32_t ece391_getdents (int32_t fd, void* buf, int32_t nbytes);
+extern int32_t ece391_mkdir (const uint8_t* path);
+extern int32_t ece391_ioctl (int32_t fd, int32_t request, int32_t arg);
+
+/* ioctl requests for the terminal (fd 0 or 1) and its line disciplines */
+#define TERMINAL_GET_MODE 0
+#define TERMINAL_SET_MODE 1
+#define TERMINAL_MODE_CANONICAL 0
+#define TERMINAL_MODE_RAW       1
 
 #endif /* ECE391SYSCALL_H */
 
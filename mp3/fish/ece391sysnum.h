@@ -11,5 +11,16 @@
 #define SYS_VIDMAP  8
 #define SYS_SET_HANDLER  9
 #define SYS_SIGRETURN  10
+#define SYS_FORK    11
+#define SYS_CREAT   12
+#define SYS_MMAP    13
+#define SYS_MUNMAP  14
+#define SYS_READV   15
+#define SYS_WRITEV  16
+#define SYS_PREAD   17
+#define SYS_PWRITE  18
+#define SYS_GETDENTS 19
+#define SYS_MKDIR   20
+#define SYS_IOCTL   21
 
 #endif /* ECE391SYSNUM_H */
@@ -0,0 +1,834 @@
+/*
+ * fsbuild - builds and checks filesystem images for the OS in student-distrib
+ *
+ * Unlike createfs it takes a directory tree, not just a flat directory, and
+ * lays each file's data blocks out in one contiguous run so read_data and the
+ * program loader copy whole runs at a time. Files listed in a profile are laid
+ * out first, most often executed first; then come directories, programs and
+ * everything else. Every image it writes is checked before it is kept, and the
+ * check ends with a fragmentation report.
+ *
+ * Runs on the host, not in the OS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+// on-disk format, see vfs.h
+#define BLOCK_SIZE 4096
+#define FILENAME_LEN 32
+#define NUM_FILES 63
+#define MAX_INODE_BLOCKS 1023
+#define MAX_FILE_SIZE (MAX_INODE_BLOCKS * BLOCK_SIZE)
+#define MAX_PATH_DEPTH 16
+#define TYPE_DEVICE 0
+#define TYPE_DIRECTORY 1
+#define TYPE_FILE 2
+
+// spare inodes and data blocks left free for files created at run time
+#define DEFAULT_SPARE_INODES 16
+#define DEFAULT_SPARE_BLOCKS 64
+// shape of generated images
+#define DEFAULT_GEN_FILES 2000
+#define DEFAULT_GEN_PER_DIR 100
+#define DEFAULT_GEN_MAX_SIZE 8192
+
+// rank of a file the profile doesn't list
+#define NOT_PROFILED 0xFFFFFFFFU
+
+typedef struct dentry_t {
+    char filename[FILENAME_LEN];
+    int32_t filetype;
+    int32_t inode_num;
+    char reserved[24];
+} dentry_t;
+
+typedef struct boot_block_t {
+    int32_t dir_count;
+    int32_t inode_count;
+    int32_t data_count;
+    char reserved[52];
+    dentry_t direntries[NUM_FILES];
+} boot_block_t;
+
+typedef struct inode_block_t {
+    int32_t length;
+    int32_t data_block_num[MAX_INODE_BLOCKS];
+} inode_block_t;
+
+/*
+ * A file or directory going into the image. Regular files are copied from
+ * host_path, or filled from gen_seed when the tree was generated.
+ */
+typedef struct node_t {
+    char name[FILENAME_LEN + 1];
+    char * image_path;              // path in the image, what the profile names
+    char * host_path;               // NULL for directories and generated files
+    int32_t type;
+    int32_t inode;
+    uint32_t length;
+    uint32_t gen_seed;
+    int32_t program;                // starts with the ELF magic
+    uint32_t rank;                  // position in the profile
+    uint32_t order;                 // position in the tree walk
+    int32_t first_block;
+    struct node_t ** children;
+    uint32_t child_count;
+    uint32_t child_space;
+} node_t;
+
+// one line of a profile
+typedef struct profile_entry_t {
+    char * path;
+    uint32_t count;                 // times executed, higher comes first
+    uint32_t line;
+} profile_entry_t;
+
+static node_t ** nodes;             // every node, in tree walk order
+static uint32_t node_count, node_space;
+static int verbose;
+
+/*
+ * die
+ *   DESCRIPTION: prints an error and exits
+ *   INPUTS: printf style message
+ *   OUTPUTS: the message on stderr
+ *   RETURN VALUE: does not return
+ *   SIDE EFFECTS: exits with status 1
+ */
+static void die(const char * message, const char * arg){
+    fprintf(stderr, "fsbuild: ");
+    fprintf(stderr, message, arg);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/*
+ * xmalloc
+ *   DESCRIPTION: malloc that exits when out of memory
+ *   INPUTS: size - bytes wanted
+ *   OUTPUTS: none
+ *   RETURN VALUE: the memory
+ *   SIDE EFFECTS: none
+ */
+static void * xmalloc(size_t size){
+    void * p = malloc(size ? size : 1);
+    if(p == NULL)
+        die("out of memory%s", "");
+    return p;
+}
+
+/*
+ * join_path
+ *   DESCRIPTION: joins a directory and a name with a '/'
+ *   INPUTS: dir - directory, "" for none; name - name in it
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new string, from malloc
+ *   SIDE EFFECTS: none
+ */
+static char * join_path(const char * dir, const char * name){
+    char * path = xmalloc(strlen(dir) + strlen(name) + 2);
+    if(dir[0] == '\0')
+        strcpy(path, name);
+    else
+        sprintf(path, "%s/%s", dir, name);
+    return path;
+}
+
+/*
+ * new_node
+ *   DESCRIPTION: adds a file or directory to the tree
+ *   INPUTS: parent - directory it goes in, NULL for the root
+ *           name - its name; type - TYPE_FILE or TYPE_DIRECTORY
+ *   OUTPUTS: none
+ *   RETURN VALUE: the node
+ *   SIDE EFFECTS: exits if the root directory is full
+ */
+static node_t * new_node(node_t * parent, const char * name, int32_t type){
+    node_t * node;
+
+    node = xmalloc(sizeof(node_t));
+    memset(node, 0, sizeof(node_t));
+    // longer names are cut short, like createfs does
+    if(strlen(name) > FILENAME_LEN)
+        fprintf(stderr, "fsbuild: %s is longer than 32 characters, cutting it short\n", name);
+    strncpy(node->name, name, FILENAME_LEN);
+    node->type = type;
+    node->rank = NOT_PROFILED;
+    node->first_block = -1;
+    node->image_path = join_path(parent ? parent->image_path : "", parent ? node->name : "");
+
+    if(parent != NULL){
+        // the root also holds "." and "rtc" in the boot block
+        if(parent->image_path[0] == '\0' && parent->child_count == NUM_FILES - 2)
+            die("more than 61 entries in the root directory, move some into subdirectories%s", "");
+        if(parent->child_count == parent->child_space){
+            parent->child_space = parent->child_space ? parent->child_space * 2 : 8;
+            parent->children = realloc(parent->children, parent->child_space * sizeof(node_t *));
+            if(parent->children == NULL)
+                die("out of memory%s", "");
+        }
+        parent->children[parent->child_count++] = node;
+    }
+
+    if(node_count == node_space){
+        node_space = node_space ? node_space * 2 : 64;
+        nodes = realloc(nodes, node_space * sizeof(node_t *));
+        if(nodes == NULL)
+            die("out of memory%s", "");
+    }
+    node->order = node_count;
+    nodes[node_count++] = node;
+    return node;
+}
+
+static int compare_names(const void * a, const void * b){
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * scan_dir
+ *   DESCRIPTION: adds everything in a host directory to the tree, going down
+ *                into subdirectories. Names are taken in sorted order so the
+ *                same tree always gives the same image
+ *   INPUTS: dir - node of the directory; host_dir - the directory on the host
+ *           depth - directories below the root
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: exits on anything the image can't hold
+ */
+static void scan_dir(node_t * dir, const char * host_dir, uint32_t depth){
+    DIR * d;
+    struct dirent * entry;
+    struct stat st;
+    char ** names = NULL;
+    uint32_t count = 0, space = 0, i;
+    node_t * node;
+    char * path;
+    unsigned char magic[4];
+    FILE * f;
+
+    if(depth > MAX_PATH_DEPTH)
+        die("directories nested too deep at %s", host_dir);
+    if((d = opendir(host_dir)) == NULL)
+        die("can't read directory %s", host_dir);
+    while((entry = readdir(d)) != NULL){
+        if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        if(count == space){
+            space = space ? space * 2 : 16;
+            names = realloc(names, space * sizeof(char *));
+            if(names == NULL)
+                die("out of memory%s", "");
+        }
+        names[count++] = strdup(entry->d_name);
+    }
+    closedir(d);
+    qsort(names, count, sizeof(char *), compare_names);
+
+    for(i = 0; i < count; i++){
+        path = join_path(host_dir, names[i]);
+        if(stat(path, &st) == -1)
+            die("can't stat %s", path);
+
+        if(S_ISDIR(st.st_mode)){
+            node = new_node(dir, names[i], TYPE_DIRECTORY);
+            scan_dir(node, path, depth + 1);
+            free(path);
+        }
+        else if(S_ISREG(st.st_mode)){
+            if(st.st_size > MAX_FILE_SIZE)
+                die("file too big for one inode: %s", path);
+            node = new_node(dir, names[i], TYPE_FILE);
+            node->host_path = path;
+            node->length = st.st_size;
+            if((f = fopen(path, "rb")) != NULL){
+                node->program = fread(magic, 1, 4, f) == 4 &&
+                                magic[0] == 0x7F && magic[1] == 'E' && magic[2] == 'L' && magic[3] == 'F';
+                fclose(f);
+            }
+        }
+        else{
+            fprintf(stderr, "fsbuild: skipping %s, not a file or directory\n", path);
+            free(path);
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+/*
+ * generate_tree
+ *   DESCRIPTION: makes up a tree for benchmarks, files directories under the
+ *                root with up to per_dir files each, of pseudo random lengths
+ *   INPUTS: root - the root node; files - how many files
+ *           per_dir - files per directory; max_size - longest file
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: exits if the directories don't fit in the root
+ */
+static void generate_tree(node_t * root, uint32_t files, uint32_t per_dir, uint32_t max_size){
+    char name[FILENAME_LEN + 1];
+    node_t * dir = NULL;
+    node_t * node;
+    uint32_t i, seed = 12345;
+
+    for(i = 0; i < files; i++){
+        if(i % per_dir == 0){
+            sprintf(name, "d%04u", i / per_dir);
+            dir = new_node(root, name, TYPE_DIRECTORY);
+        }
+        sprintf(name, "f%06u", i);
+        node = new_node(dir, name, TYPE_FILE);
+        seed = seed * 1103515245 + 12345;
+        node->length = (seed >> 8) % (max_size + 1);
+        node->gen_seed = i;
+    }
+}
+
+static int compare_profile(const void * a, const void * b){
+    const profile_entry_t * x = a;
+    const profile_entry_t * y = b;
+    if(x->count != y->count)
+        return (x->count > y->count) ? -1 : 1;
+    return (x->line < y->line) ? -1 : 1;
+}
+
+/*
+ * load_profile
+ *   DESCRIPTION: reads an execute-frequency profile and ranks the files it
+ *                names. Each line is a path in the image and optionally how many
+ *                times it runs; files run more often rank first, and lines
+ *                without a count keep their order after those with one
+ *   INPUTS: path - the profile on the host
+ *   OUTPUTS: sets rank in the nodes the profile lists
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: warns about paths that aren't in the tree
+ */
+static void load_profile(const char * path){
+    FILE * f;
+    char line[512], file[512];
+    profile_entry_t * entries = NULL;
+    uint32_t count = 0, space = 0, lines = 0, i, j;
+    unsigned int runs;
+    int fields;
+    char * name;
+
+    if((f = fopen(path, "r")) == NULL)
+        die("can't read profile %s", path);
+    while(fgets(line, sizeof(line), f) != NULL){
+        lines++;
+        runs = 0;
+        fields = sscanf(line, "%511s %u", file, &runs);
+        if(fields < 1 || file[0] == '#')
+            continue;
+        if(count == space){
+            space = space ? space * 2 : 32;
+            entries = realloc(entries, space * sizeof(profile_entry_t));
+            if(entries == NULL)
+                die("out of memory%s", "");
+        }
+        // paths start at the root with or without a leading '/'
+        name = file;
+        while(*name == '/')
+            name++;
+        entries[count].path = strdup(name);
+        entries[count].count = runs;
+        entries[count].line = lines;
+        count++;
+    }
+    fclose(f);
+    qsort(entries, count, sizeof(profile_entry_t), compare_profile);
+
+    for(i = 0; i < count; i++){
+        for(j = 0; j < node_count; j++){
+            if(strcmp(nodes[j]->image_path, entries[i].path) == 0)
+                break;
+        }
+        if(j == node_count || nodes[j]->type != TYPE_FILE)
+            fprintf(stderr, "fsbuild: profile names %s, which isn't a file in the tree\n", entries[i].path);
+        else if(nodes[j]->rank == NOT_PROFILED)
+            nodes[j]->rank = i;
+        free(entries[i].path);
+    }
+    free(entries);
+}
+
+/*
+ * layout_class
+ *   DESCRIPTION: orders files the profile doesn't list: directories, which
+ *                every path lookup reads, then programs, then the rest
+ *   INPUTS: node - the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: lower comes first
+ *   SIDE EFFECTS: none
+ */
+static int layout_class(const node_t * node){
+    if(node->type == TYPE_DIRECTORY)
+        return 0;
+    return node->program ? 1 : 2;
+}
+
+static int compare_layout(const void * a, const void * b){
+    const node_t * x = *(node_t * const *)a;
+    const node_t * y = *(node_t * const *)b;
+    if(x->rank != y->rank)
+        return (x->rank < y->rank) ? -1 : 1;
+    if(layout_class(x) != layout_class(y))
+        return layout_class(x) - layout_class(y);
+    return (x->order < y->order) ? -1 : 1;
+}
+
+/*
+ * node_blocks
+ *   DESCRIPTION: finds how many data blocks a file or directory needs
+ *   INPUTS: node - the file
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of blocks
+ *   SIDE EFFECTS: none
+ */
+static uint32_t node_blocks(const node_t * node){
+    return (node->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+/*
+ * fill_node
+ *   DESCRIPTION: writes a file's or directory's contents into its data blocks
+ *   INPUTS: node - the file; data - its first data block in the image
+ *   OUTPUTS: the contents, the rest of the last block stays zero
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: exits if a host file can't be read
+ */
+static void fill_node(const node_t * node, uint8_t * data){
+    dentry_t * dentry;
+    FILE * f;
+    uint32_t i, name_length;
+
+    if(node->type == TYPE_DIRECTORY){
+        dentry = (dentry_t *)data;
+        for(i = 0; i < node->child_count; i++){
+            memcpy(dentry[i].filename, node->children[i]->name, strlen(node->children[i]->name));
+            dentry[i].filetype = node->children[i]->type;
+            dentry[i].inode_num = node->children[i]->inode;
+        }
+    }
+    else if(node->host_path != NULL){
+        if((f = fopen(node->host_path, "rb")) == NULL || fread(data, 1, node->length, f) != node->length)
+            die("can't read %s", node->host_path);
+        fclose(f);
+    }
+    else{
+        // generated file, its name and then a pattern that differs from file to file
+        name_length = strlen(node->image_path);
+        for(i = 0; i < node->length; i++)
+            data[i] = (i < name_length) ? node->image_path[i] : (uint8_t)('a' + (node->gen_seed + i) % 26);
+    }
+}
+
+/*
+ * build_image
+ *   DESCRIPTION: numbers the inodes, lays out the data blocks and writes the
+ *                whole image into memory. Inode 0 is left for "." and rtc like
+ *                createfs does, every other file gets the next inode in tree order
+ *   INPUTS: root - the root node; spare_inodes, spare_blocks - free space to leave
+ *   OUTPUTS: size - bytes in the image
+ *   RETURN VALUE: the image, from malloc
+ *   SIDE EFFECTS: none
+ */
+static uint8_t * build_image(node_t * root, uint32_t spare_inodes, uint32_t spare_blocks, uint32_t * size){
+    node_t ** layout;
+    boot_block_t * boot;
+    inode_block_t * inode_block;
+    uint8_t * image;
+    uint32_t i, j, inodes, blocks, next_block, count;
+    node_t * node;
+
+    // inode numbers in tree order, the root itself lives in the boot block
+    inodes = 1;
+    for(i = 0; i < node_count; i++){
+        node = nodes[i];
+        if(node == root)
+            continue;
+        node->inode = inodes++;
+        if(node->type == TYPE_DIRECTORY)
+            node->length = node->child_count * sizeof(dentry_t);
+    }
+
+    // data blocks in profile, then class, then tree order, each file in one run
+    layout = xmalloc(node_count * sizeof(node_t *));
+    for(i = count = 0; i < node_count; i++){
+        if(nodes[i] != root)
+            layout[count++] = nodes[i];
+    }
+    qsort(layout, count, sizeof(node_t *), compare_layout);
+    for(i = next_block = 0; i < count; i++){
+        layout[i]->first_block = next_block;
+        next_block += node_blocks(layout[i]);
+    }
+
+    inodes += spare_inodes;
+    blocks = next_block + spare_blocks;
+    *size = (1 + inodes + blocks) * BLOCK_SIZE;
+    image = xmalloc(*size);
+    memset(image, 0, *size);
+
+    boot = (boot_block_t *)image;
+    boot->inode_count = inodes;
+    boot->data_count = blocks;
+    strcpy(boot->direntries[0].filename, ".");
+    boot->direntries[0].filetype = TYPE_DIRECTORY;
+    strcpy(boot->direntries[1].filename, "rtc");
+    boot->direntries[1].filetype = TYPE_DEVICE;
+    boot->dir_count = 2;
+    for(i = 0; i < root->child_count; i++){
+        memcpy(boot->direntries[boot->dir_count].filename, root->children[i]->name, strlen(root->children[i]->name));
+        boot->direntries[boot->dir_count].filetype = root->children[i]->type;
+        boot->direntries[boot->dir_count].inode_num = root->children[i]->inode;
+        boot->dir_count++;
+    }
+
+    for(i = 0; i < count; i++){
+        node = layout[i];
+        inode_block = (inode_block_t *)(image + (1 + node->inode) * BLOCK_SIZE);
+        inode_block->length = node->length;
+        for(j = 0; j < node_blocks(node); j++)
+            inode_block->data_block_num[j] = node->first_block + j;
+        fill_node(node, image + (1 + inodes + node->first_block) * BLOCK_SIZE);
+    }
+    free(layout);
+    return image;
+}
+
+/*
+ * Totals gathered by check_image
+ */
+typedef struct check_t {
+    uint8_t * image;
+    uint32_t size;
+    boot_block_t * boot;
+    int32_t * block_owner;          // inode using each data block, -1 if free
+    uint8_t * inode_used;
+    uint32_t errors;
+    uint32_t files, directories, devices;
+    uint32_t used_blocks;
+    uint32_t fragmented;            // files in more than one run
+    uint32_t extents;               // runs over all files
+    uint32_t worst_extents;
+    char worst_path[512];
+} check_t;
+
+/*
+ * check_error
+ *   DESCRIPTION: reports a problem with the image
+ *   INPUTS: check - totals; message, path - printf style message naming a file
+ *   OUTPUTS: the message on stdout
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: counts the error
+ */
+static void check_error(check_t * check, const char * message, const char * path){
+    printf("error: ");
+    printf(message, path);
+    printf("\n");
+    check->errors++;
+}
+
+/*
+ * check_inode
+ *   DESCRIPTION: checks an inode's length and blocks, claims its blocks and
+ *                counts the runs of consecutive blocks it is stored in
+ *   INPUTS: check - totals; inode - inode number; path - file using it
+ *   OUTPUTS: none
+ *   RETURN VALUE: the inode block, NULL if it is unusable
+ *   SIDE EFFECTS: marks the blocks in block_owner
+ */
+static inode_block_t * check_inode(check_t * check, int32_t inode, const char * path){
+    inode_block_t * inode_block = (inode_block_t *)(check->image + (1 + inode) * BLOCK_SIZE);
+    uint32_t blocks, j, extents = 0;
+    int32_t block, bad = 0;
+
+    if(inode_block->length < 0 || inode_block->length > MAX_FILE_SIZE){
+        check_error(check, "%s: bad length", path);
+        return NULL;
+    }
+    blocks = (inode_block->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    for(j = 0; j < blocks; j++){
+        block = inode_block->data_block_num[j];
+        if(block < 0 || block >= check->boot->data_count){
+            check_error(check, "%s: data block out of range", path);
+            bad = 1;
+            continue;
+        }
+        if(check->block_owner[block] != -1){
+            check_error(check, "%s: data block also used by another file", path);
+            bad = 1;
+        }
+        check->block_owner[block] = inode;
+        check->used_blocks++;
+        if(j == 0 || block != inode_block->data_block_num[j - 1] + 1)
+            extents++;
+    }
+
+    check->extents += extents;
+    if(extents > 1)
+        check->fragmented++;
+    if(extents > check->worst_extents){
+        check->worst_extents = extents;
+        strncpy(check->worst_path, path, sizeof(check->worst_path) - 1);
+    }
+    if(verbose)
+        printf("  %-40s inode %5d %8d bytes %5u blocks %3u runs, first block %d\n", path, inode,
+               inode_block->length, blocks, extents, blocks ? inode_block->data_block_num[0] : -1);
+    return bad ? NULL : inode_block;
+}
+
+/*
+ * check_dir
+ *   DESCRIPTION: checks every entry of a directory and goes down into its
+ *                subdirectories
+ *   INPUTS: check - totals; entries, count - the directory's entries
+ *           path - its path, "" for the root; depth - directories below the root
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: marks inodes and blocks
+ */
+static void check_dir(check_t * check, const dentry_t * entries, uint32_t count, const char * path, uint32_t depth){
+    inode_block_t * inode_block;
+    dentry_t * sub;
+    char name[FILENAME_LEN + 1];
+    char * child;
+    uint32_t i, j, blocks;
+
+    for(i = 0; i < count; i++){
+        memcpy(name, entries[i].filename, FILENAME_LEN);
+        name[FILENAME_LEN] = '\0';
+        child = join_path(path, name);
+
+        if(name[0] == '\0')
+            check_error(check, "empty name in directory /%s", path);
+        for(j = 0; j < i; j++){
+            if(strncmp(entries[j].filename, entries[i].filename, FILENAME_LEN) == 0)
+                check_error(check, "%s: name appears twice", child);
+        }
+
+        if(strcmp(name, ".") == 0 || strcmp(name, "..") == 0){
+            free(child);
+            continue;
+        }
+        if(entries[i].filetype == TYPE_DEVICE){
+            check->devices++;
+            free(child);
+            continue;
+        }
+        if(entries[i].filetype != TYPE_FILE && entries[i].filetype != TYPE_DIRECTORY){
+            check_error(check, "%s: unknown file type", child);
+            free(child);
+            continue;
+        }
+        if(entries[i].inode_num < 0 || entries[i].inode_num >= check->boot->inode_count){
+            check_error(check, "%s: inode out of range", child);
+            free(child);
+            continue;
+        }
+        if(check->inode_used[entries[i].inode_num]){
+            check_error(check, "%s: inode already used by another entry", child);
+            free(child);
+            continue;
+        }
+        check->inode_used[entries[i].inode_num] = 1;
+
+        inode_block = check_inode(check, entries[i].inode_num, child);
+        if(entries[i].filetype == TYPE_FILE){
+            check->files++;
+        }
+        else{
+            check->directories++;
+            if(inode_block != NULL && inode_block->length % sizeof(dentry_t) != 0)
+                check_error(check, "%s: directory length isn't a whole number of entries", child);
+            if(depth == MAX_PATH_DEPTH)
+                check_error(check, "%s: directories nested too deep", child);
+            else if(inode_block != NULL){
+                // gather the entries, the directory may not be contiguous
+                blocks = (inode_block->length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+                sub = xmalloc(blocks * BLOCK_SIZE);
+                for(j = 0; j < blocks; j++)
+                    memcpy((uint8_t *)sub + j * BLOCK_SIZE,
+                           check->image + (1 + check->boot->inode_count + inode_block->data_block_num[j]) * BLOCK_SIZE,
+                           BLOCK_SIZE);
+                check_dir(check, sub, inode_block->length / sizeof(dentry_t), child, depth + 1);
+                free(sub);
+            }
+        }
+        free(child);
+    }
+}
+
+/*
+ * check_image
+ *   DESCRIPTION: checks that an image is one the OS can mount and reports how
+ *                fragmented its files are
+ *   INPUTS: image, size - the image
+ *   OUTPUTS: errors and the report on stdout
+ *   RETURN VALUE: number of errors
+ *   SIDE EFFECTS: none
+ */
+static uint32_t check_image(uint8_t * image, uint32_t size){
+    check_t check;
+    uint32_t i, used_inodes = 0, dir_count;
+
+    memset(&check, 0, sizeof(check));
+    check.image = image;
+    check.size = size;
+    check.boot = (boot_block_t *)image;
+
+    if(size < BLOCK_SIZE || check.boot->inode_count <= 0 || check.boot->data_count < 0 ||
+       (uint64_t)(1 + check.boot->inode_count + check.boot->data_count) * BLOCK_SIZE > size){
+        printf("error: boot block counts don't match the image size\n");
+        return 1;
+    }
+    dir_count = check.boot->dir_count;
+    if(check.boot->dir_count < 0 || check.boot->dir_count > NUM_FILES){
+        check_error(&check, "root directory entry count out of range%s", "");
+        dir_count = NUM_FILES;
+    }
+
+    check.block_owner = xmalloc(check.boot->data_count * sizeof(int32_t) + 1);
+    for(i = 0; i < (uint32_t)check.boot->data_count; i++)
+        check.block_owner[i] = -1;
+    check.inode_used = xmalloc(check.boot->inode_count);
+    memset(check.inode_used, 0, check.boot->inode_count);
+
+    if(verbose)
+        printf("files:\n");
+    check_dir(&check, check.boot->direntries, dir_count, "", 0);
+
+    for(i = 0; i < (uint32_t)check.boot->inode_count; i++)
+        used_inodes += check.inode_used[i];
+    printf("%u files, %u directories, %u devices\n", check.files, check.directories, check.devices);
+    printf("inodes: %u of %d used\n", used_inodes, check.boot->inode_count);
+    printf("data blocks: %u of %d used\n", check.used_blocks, check.boot->data_count);
+    printf("fragmentation: %u of %u files and directories in more than one run, %u runs in all",
+           check.fragmented, check.files + check.directories, check.extents);
+    if(check.worst_extents > 1)
+        printf(", worst %s with %u", check.worst_path, check.worst_extents);
+    printf("\n");
+    if(check.errors)
+        printf("%u errors\n", check.errors);
+
+    free(check.block_owner);
+    free(check.inode_used);
+    return check.errors;
+}
+
+/*
+ * write_image
+ *   DESCRIPTION: writes an image to a host file
+ *   INPUTS: path - the file; image, size - the image
+ *   OUTPUTS: the file
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: exits if the file can't be written
+ */
+static void write_image(const char * path, const uint8_t * image, uint32_t size){
+    FILE * f = fopen(path, "wb");
+    if(f == NULL || fwrite(image, 1, size, f) != size || fclose(f) != 0)
+        die("can't write %s", path);
+}
+
+/*
+ * read_image
+ *   DESCRIPTION: reads a whole image from a host file
+ *   INPUTS: path - the file
+ *   OUTPUTS: size - bytes read
+ *   RETURN VALUE: the image, from malloc
+ *   SIDE EFFECTS: exits if the file can't be read
+ */
+static uint8_t * read_image(const char * path, uint32_t * size){
+    struct stat st;
+    uint8_t * image;
+    FILE * f;
+
+    if(stat(path, &st) == -1 || (f = fopen(path, "rb")) == NULL)
+        die("can't read %s", path);
+    image = xmalloc(st.st_size);
+    if(fread(image, 1, st.st_size, f) != (size_t)st.st_size)
+        die("can't read %s", path);
+    fclose(f);
+    *size = st.st_size;
+    return image;
+}
+
+static void usage(void){
+    fprintf(stderr,
+            "usage: fsbuild build [-v] [-p profile] [-i spare_inodes] [-b spare_blocks] <dir> <image>\n"
+            "       fsbuild gen [-v] [-n files] [-w files_per_dir] [-s max_size] [-i spare_inodes] [-b spare_blocks] <image>\n"
+            "       fsbuild check [-v] <image>\n"
+            "\n"
+            "build  makes an image from a directory tree. A profile lists paths in the image,\n"
+            "       each optionally followed by how many times it is executed; those files are\n"
+            "       laid out first, most executed first.\n"
+            "gen    makes an image of generated files spread over subdirectories, for benchmarks.\n"
+            "check  checks an image and reports how fragmented its files are.\n"
+            "-v     lists every file with its inode and block runs.\n");
+    exit(1);
+}
+
+int main(int argc, char ** argv){
+    const char * command, * profile = NULL;
+    uint32_t spare_inodes = DEFAULT_SPARE_INODES, spare_blocks = DEFAULT_SPARE_BLOCKS;
+    uint32_t files = DEFAULT_GEN_FILES, per_dir = DEFAULT_GEN_PER_DIR, max_size = DEFAULT_GEN_MAX_SIZE;
+    uint32_t size;
+    uint8_t * image;
+    node_t * root;
+    int opt;
+
+    if(argc < 2)
+        usage();
+    command = argv[1];
+    optind = 2;
+    while((opt = getopt(argc, argv, "vp:i:b:n:w:s:")) != -1){
+        switch(opt){
+            case 'v': verbose = 1; break;
+            case 'p': profile = optarg; break;
+            case 'i': spare_inodes = strtoul(optarg, NULL, 0); break;
+            case 'b': spare_blocks = strtoul(optarg, NULL, 0); break;
+            case 'n': files = strtoul(optarg, NULL, 0); break;
+            case 'w': per_dir = strtoul(optarg, NULL, 0); break;
+            case 's': max_size = strtoul(optarg, NULL, 0); break;
+            default: usage();
+        }
+    }
+
+    if(strcmp(command, "check") == 0){
+        if(optind != argc - 1)
+            usage();
+        image = read_image(argv[optind], &size);
+        return check_image(image, size) ? 1 : 0;
+    }
+
+    root = new_node(NULL, "", TYPE_DIRECTORY);
+    if(strcmp(command, "build") == 0){
+        if(optind != argc - 2)
+            usage();
+        scan_dir(root, argv[optind], 0);
+        if(profile != NULL)
+            load_profile(profile);
+    }
+    else if(strcmp(command, "gen") == 0){
+        if(optind != argc - 1 || per_dir == 0 || max_size > MAX_FILE_SIZE)
+            usage();
+        generate_tree(root, files, per_dir, max_size);
+    }
+    else{
+        usage();
+    }
+
+    image = build_image(root, spare_inodes, spare_blocks, &size);
+    if(check_image(image, size) != 0)
+        die("the new image failed its check, not writing it%s", "");
+    write_image(argv[argc - 1], image, size);
+    return 0;
+}
@@ -0,0 +1,434 @@
+#include "block_cache.h"
+#include "page_alloc.h"
+#include "lib.h"
+
+/*
+ * Block cache between the filesystem and the device it lives on. Buffers are
+ * found through a hash of the block number and kept on one LRU list, most
+ * recently used first. A miss takes the least recently used buffer nobody holds,
+ * writing it back first if it is dirty. There is one cache, in front of the
+ * device the filesystem was mounted from.
+ */
+
+block_cache_stats_t block_cache_stats;
+
+static block_device_t * cache_dev;
+static buffer_t buffers[BLOCK_CACHE_SIZE];
+static uint32_t num_buffers;
+static buffer_t * block_hash[BLOCK_HASH_SIZE];
+static buffer_t * lru_head;          // most recently used
+static buffer_t * lru_tail;          // least recently used
+
+
+/*
+ * memory_read_block
+ *   DESCRIPTION: copies a block out of an in-memory image
+ *   INPUTS: dev - the device, block - block number, buf - BLOCK_SIZE bytes to fill
+ *   OUTPUTS: buf
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: none
+ */
+static int32_t memory_read_block(block_device_t * dev, uint32_t block, uint8_t * buf){
+    memcpy(buf, (uint8_t *)dev->private_data + block * BLOCK_SIZE, BLOCK_SIZE);
+    return 0;
+}
+
+/*
+ * memory_write_block
+ *   DESCRIPTION: copies a block into an in-memory image
+ *   INPUTS: dev - the device, block - block number, buf - BLOCK_SIZE bytes to write
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0
+ *   SIDE EFFECTS: changes the image
+ */
+static int32_t memory_write_block(block_device_t * dev, uint32_t block, const uint8_t * buf){
+    memcpy((uint8_t *)dev->private_data + block * BLOCK_SIZE, buf, BLOCK_SIZE);
+    return 0;
+}
+
+/*
+ * memory_block_address
+ *   DESCRIPTION: finds a block of an in-memory image
+ *   INPUTS: dev - the device, block - block number
+ *   OUTPUTS: none
+ *   RETURN VALUE: address of the block
+ *   SIDE EFFECTS: none
+ */
+static uint8_t * memory_block_address(block_device_t * dev, uint32_t block){
+    return (uint8_t *)dev->private_data + block * BLOCK_SIZE;
+}
+
+static const block_device_ops_t memory_block_ops = {
+    memory_read_block,
+    memory_write_block,
+    memory_block_address
+};
+
+/*
+ * memory_block_device_init
+ *   DESCRIPTION: sets up a device over an image already in memory, like the
+ *                filesystem module GRUB loads
+ *   INPUTS: dev - device to fill in, base - start of the image, size - its size in bytes
+ *   OUTPUTS: dev
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void memory_block_device_init(block_device_t * dev, uint8_t * base, uint32_t size){
+    dev->name = "module";
+    dev->block_count = size / BLOCK_SIZE;
+    dev->ops = &memory_block_ops;
+    dev->private_data = base;
+}
+
+/*
+ * lru_remove
+ *   DESCRIPTION: takes a buffer off the LRU list
+ *   INPUTS: buf - buffer on the list
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the LRU list
+ */
+static void lru_remove(buffer_t * buf){
+    if(buf->lru_prev != NULL)
+        buf->lru_prev->lru_next = buf->lru_next;
+    else
+        lru_head = buf->lru_next;
+    if(buf->lru_next != NULL)
+        buf->lru_next->lru_prev = buf->lru_prev;
+    else
+        lru_tail = buf->lru_prev;
+}
+
+/*
+ * lru_push_front
+ *   DESCRIPTION: puts a buffer at the most recently used end of the LRU list
+ *   INPUTS: buf - buffer not on the list
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the LRU list
+ */
+static void lru_push_front(buffer_t * buf){
+    buf->lru_prev = NULL;
+    buf->lru_next = lru_head;
+    if(lru_head != NULL)
+        lru_head->lru_prev = buf;
+    else
+        lru_tail = buf;
+    lru_head = buf;
+}
+
+/*
+ * lru_push_back
+ *   DESCRIPTION: puts a buffer at the least recently used end of the LRU list
+ *   INPUTS: buf - buffer not on the list
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the LRU list
+ */
+static void lru_push_back(buffer_t * buf){
+    buf->lru_next = NULL;
+    buf->lru_prev = lru_tail;
+    if(lru_tail != NULL)
+        lru_tail->lru_next = buf;
+    else
+        lru_head = buf;
+    lru_tail = buf;
+}
+
+/*
+ * hash_find
+ *   DESCRIPTION: looks a block up in the cache
+ *   INPUTS: block - block number
+ *   OUTPUTS: none
+ *   RETURN VALUE: the buffer holding the block, NULL if it is not cached
+ *   SIDE EFFECTS: none
+ */
+static buffer_t * hash_find(uint32_t block){
+    buffer_t * buf;
+
+    for(buf = block_hash[block & (BLOCK_HASH_SIZE - 1)]; buf != NULL; buf = buf->hash_next){
+        if(buf->block == block)
+            return buf;
+    }
+    return NULL;
+}
+
+/*
+ * hash_remove
+ *   DESCRIPTION: takes a buffer out of the block number hash
+ *   INPUTS: buf - buffer in the hash
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the hash
+ */
+static void hash_remove(buffer_t * buf){
+    buffer_t ** link = &block_hash[buf->block & (BLOCK_HASH_SIZE - 1)];
+
+    while(*link != NULL && *link != buf)
+        link = &(*link)->hash_next;
+    if(*link != NULL)
+        *link = buf->hash_next;
+}
+
+/*
+ * write_back
+ *   DESCRIPTION: writes a dirty buffer to the device
+ *   INPUTS: buf - the buffer
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the device failed
+ *   SIDE EFFECTS: clears dirty
+ */
+static int32_t write_back(buffer_t * buf){
+    if(!buf->dirty)
+        return 0;
+    if(cache_dev->ops->write_block == NULL || cache_dev->ops->write_block(cache_dev, buf->block, buf->data) != 0)
+        return -1;
+    buf->dirty = 0;
+    block_cache_stats.writebacks++;
+    return 0;
+}
+
+/*
+ * get_buffer
+ *   DESCRIPTION: takes the least recently used buffer nobody holds and reads a
+ *                block into it
+ *   INPUTS: block - block number, not in the cache
+ *   OUTPUTS: none
+ *   RETURN VALUE: the buffer at the most recently used end of the list, NULL if
+ *                 every buffer is held or the device failed
+ *   SIDE EFFECTS: may evict a block
+ */
+static buffer_t * get_buffer(uint32_t block){
+    buffer_t * buf;
+
+    for(buf = lru_tail; buf != NULL; buf = buf->lru_prev){
+        if(buf->refcount == 0 && write_back(buf) == 0)
+            break;
+    }
+    if(buf == NULL)
+        return NULL;
+
+    if(buf->valid){
+        hash_remove(buf);
+        buf->valid = 0;
+        block_cache_stats.evictions++;
+    }
+
+    if(cache_dev->ops->read_block(cache_dev, block, buf->data) != 0){
+        //Leave it at the end of the list so it is the next one reused
+        lru_remove(buf);
+        lru_push_back(buf);
+        return NULL;
+    }
+
+    buf->block = block;
+    buf->valid = 1;
+    buf->read_ahead = 0;
+    buf->hash_next = block_hash[block & (BLOCK_HASH_SIZE - 1)];
+    block_hash[block & (BLOCK_HASH_SIZE - 1)] = buf;
+    lru_remove(buf);
+    lru_push_front(buf);
+    return buf;
+}
+
+/*
+ * block_cache_init
+ *   DESCRIPTION: allocates the buffers and puts the cache in front of a device.
+ *                Needs the page allocator
+ *   INPUTS: dev - the device the filesystem is on
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if no buffer could be allocated
+ *   SIDE EFFECTS: allocates up to BLOCK_CACHE_SIZE frames
+ */
+int32_t block_cache_init(block_device_t * dev){
+    uint32_t i, frame;
+
+    cache_dev = dev;
+    for(i = 0; i < BLOCK_CACHE_SIZE; i++){
+        frame = alloc_pages(ALLOC_KERNEL, 0);
+        if(frame == 0)
+            break;
+        buffers[i].data = (uint8_t *)frame;
+        lru_push_back(&buffers[i]);
+    }
+    num_buffers = i;
+    return (num_buffers == 0) ? -1 : 0;
+}
+
+/*
+ * bread
+ *   DESCRIPTION: gets a block from the cache, reading it from the device on a miss
+ *   INPUTS: block - block number
+ *   OUTPUTS: none
+ *   RETURN VALUE: the buffer, held until brelse. NULL if the block is past the end
+ *                 of the device, every buffer is held, or the device failed
+ *   SIDE EFFECTS: moves the block to the most recently used end of the list
+ */
+buffer_t * bread(uint32_t block){
+    buffer_t * buf;
+    uint32_t flags;
+
+    if(cache_dev == NULL || block >= cache_dev->block_count)
+        return NULL;
+
+    cli_and_save(flags);
+    buf = hash_find(block);
+    if(buf != NULL){
+        block_cache_stats.hits++;
+        if(buf->read_ahead){
+            block_cache_stats.read_ahead_hits++;
+            buf->read_ahead = 0;
+        }
+        lru_remove(buf);
+        lru_push_front(buf);
+    }
+    else{
+        block_cache_stats.misses++;
+        buf = get_buffer(block);
+    }
+    if(buf != NULL)
+        buf->refcount++;
+    restore_flags(flags);
+    return buf;
+}
+
+/*
+ * brelse
+ *   DESCRIPTION: gives back a buffer from bread, it stays cached
+ *   INPUTS: buf - the buffer, NULL is ignored
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void brelse(buffer_t * buf){
+    uint32_t flags;
+
+    if(buf == NULL)
+        return;
+    cli_and_save(flags);
+    if(buf->refcount > 0)
+        buf->refcount--;
+    restore_flags(flags);
+}
+
+/*
+ * bdirty
+ *   DESCRIPTION: marks a held buffer as changed
+ *   INPUTS: buf - buffer from bread
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: the block is written back before its buffer is reused
+ */
+void bdirty(buffer_t * buf){
+    buf->dirty = 1;
+}
+
+/*
+ * block_cache_read_ahead
+ *   DESCRIPTION: reads blocks a caller expects to need soon. Blocks the device keeps
+ *                in memory are skipped, readers copy those from the device directly
+ *                and would never use the buffer. Stops at the first block it can not
+ *                read, or when only held buffers are left
+ *   INPUTS: block - first block, count - number of blocks, capped at READ_AHEAD_BLOCKS
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may evict blocks
+ */
+void block_cache_read_ahead(uint32_t block, uint32_t count){
+    buffer_t * buf;
+    uint32_t flags;
+
+    if(cache_dev == NULL)
+        return;
+    if(count > READ_AHEAD_BLOCKS)
+        count = READ_AHEAD_BLOCKS;
+
+    cli_and_save(flags);
+    for(; count > 0 && block < cache_dev->block_count; block++, count--){
+        if(hash_find(block) != NULL || block_address(block) != NULL)
+            continue;
+        buf = get_buffer(block);
+        if(buf == NULL)
+            break;
+        buf->read_ahead = 1;
+        block_cache_stats.read_ahead++;
+    }
+    restore_flags(flags);
+}
+
+/*
+ * block_cache_sync
+ *   DESCRIPTION: writes every dirty buffer back to the device
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if any write failed
+ *   SIDE EFFECTS: clears dirty on the buffers written
+ */
+int32_t block_cache_sync(void){
+    uint32_t i, flags;
+    int32_t ret = 0;
+
+    cli_and_save(flags);
+    for(i = 0; i < num_buffers; i++){
+        if(buffers[i].valid && write_back(&buffers[i]) != 0)
+            ret = -1;
+    }
+    restore_flags(flags);
+    return ret;
+}
+
+/*
+ * block_address
+ *   DESCRIPTION: finds a block the device keeps in memory, so it can be mapped
+ *                instead of copied. Only valid while the cache has no newer copy
+ *   INPUTS: block - block number
+ *   OUTPUTS: none
+ *   RETURN VALUE: address of the block, NULL if the device has no such address,
+ *                 the block is past its end, or the cache holds unwritten changes to it
+ *   SIDE EFFECTS: none
+ */
+uint8_t * block_address(uint32_t block){
+    buffer_t * buf;
+
+    if(cache_dev == NULL || cache_dev->ops->block_address == NULL || block >= cache_dev->block_count)
+        return NULL;
+    buf = hash_find(block);
+    if(buf != NULL && buf->dirty)
+        return NULL;
+    return cache_dev->ops->block_address(cache_dev, block);
+}
+
+/*
+ * block_run_address
+ *   DESCRIPTION: block_address for a run of blocks, so the run can be copied at once
+ *   INPUTS: block - the first block; count - number of blocks in the run
+ *   OUTPUTS: none
+ *   RETURN VALUE: address of the first block, NULL unless every block has an address
+ *                 and they follow each other in memory
+ *   SIDE EFFECTS: none
+ */
+uint8_t * block_run_address(uint32_t block, uint32_t count){
+    uint8_t * start = block_address(block);
+    uint32_t i;
+
+    for(i = 1; start != NULL && i < count; i++){
+        if(block_address(block + i) != start + i * BLOCK_SIZE)
+            return NULL;
+    }
+    return start;
+}
+
+/*
+ * print_block_cache_stats
+ *   DESCRIPTION: prints the cache counters
+ *   INPUTS: none
+ *   OUTPUTS: prints to the screen
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void print_block_cache_stats(void){
+    printf("block cache (%s, %d buffers): hits %d, misses %d, direct %d, read ahead %d (%d used), evictions %d, writebacks %d\n",
+           cache_dev->name, num_buffers, block_cache_stats.hits, block_cache_stats.misses,
+           block_cache_stats.direct, block_cache_stats.read_ahead, block_cache_stats.read_ahead_hits,
+           block_cache_stats.evictions, block_cache_stats.writebacks);
+}
@@ -0,0 +1,93 @@
+#ifndef BLOCK_CACHE_H_
+#define BLOCK_CACHE_H_
+
+#include "types.h"
+
+// the filesystem's block size, one buffer holds one block
+#define BLOCK_SIZE 4096
+// number of buffers in the cache
+#define BLOCK_CACHE_SIZE 64
+// buckets in the block number hash, a power of 2
+#define BLOCK_HASH_SIZE 64
+// most blocks read ahead after a miss
+#define READ_AHEAD_BLOCKS 4
+
+struct block_device_t;
+
+/*
+ * Where the cache reads blocks from and writes them back to. read_block and
+ * write_block move one block, block_address is optional and only set by devices
+ * that keep every block in memory (so callers can map a block instead of copying it).
+ */
+typedef struct block_device_ops_t {
+    int32_t (*read_block)(struct block_device_t * dev, uint32_t block, uint8_t * buf);
+    int32_t (*write_block)(struct block_device_t * dev, uint32_t block, const uint8_t * buf);
+    uint8_t * (*block_address)(struct block_device_t * dev, uint32_t block);
+} block_device_ops_t;
+
+typedef struct block_device_t {
+    const char * name;
+    uint32_t block_count;
+    const block_device_ops_t * ops;
+    void * private_data;            // for the driver, the memory device keeps its base address here
+} block_device_t;
+
+/*
+ * A cached block. Buffers with refcount 0 can be evicted, the least recently
+ * used one first. A buffer is on the LRU list whether or not it is in use.
+ */
+typedef struct buffer_t {
+    uint32_t block;
+    uint32_t refcount;              // bread calls not yet matched by brelse
+    uint8_t valid;                  // data holds the block
+    uint8_t dirty;                  // data changed and must be written back before eviction
+    uint8_t read_ahead;             // read ahead and not used since
+    uint8_t * data;                 // BLOCK_SIZE bytes
+    struct buffer_t * hash_next;
+    struct buffer_t * lru_prev;     // towards the most recently used end
+    struct buffer_t * lru_next;     // towards the least recently used end
+} buffer_t;
+
+typedef struct block_cache_stats_t {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t read_ahead;            // blocks read before anyone asked for them
+    uint32_t read_ahead_hits;       // read ahead blocks that were used later
+    uint32_t evictions;
+    uint32_t writebacks;
+    uint32_t direct;                // blocks read straight from a device that keeps them in memory, bypassing the buffers
+} block_cache_stats_t;
+
+extern block_cache_stats_t block_cache_stats;
+
+/* Sets up a device over a filesystem image that is already in memory */
+void memory_block_device_init(block_device_t * dev, uint8_t * base, uint32_t size);
+
+/* Allocates the buffers and puts the cache in front of a device */
+int32_t block_cache_init(block_device_t * dev);
+
+/* Returns the buffer holding a block, read in if needed. NULL on a bad block or I/O error */
+buffer_t * bread(uint32_t block);
+
+/* Gives back a buffer from bread */
+void brelse(buffer_t * buf);
+
+/* Marks a buffer from bread as changed, it is written back on eviction or block_cache_sync */
+void bdirty(buffer_t * buf);
+
+/* Reads up to count blocks starting at block into the cache, without holding them */
+void block_cache_read_ahead(uint32_t block, uint32_t count);
+
+/* Writes every dirty buffer back to the device */
+int32_t block_cache_sync(void);
+
+/* Address of a block the device keeps in memory, NULL if it has to go through the cache */
+uint8_t * block_address(uint32_t block);
+
+/* Address of count consecutive blocks the device keeps in memory one after another, NULL if any has to go through the cache */
+uint8_t * block_run_address(uint32_t block, uint32_t count);
+
+/* Prints the cache counters */
+void print_block_cache_stats(void);
+
+#endif
@@ -4,6 +4,12 @@
 extern void context_switch(uint32_t eip, uint32_t esp, uint32_t ebp);
 extern void kernel_context_switch(uint32_t eip, uint32_t esp, uint32_t ebp);
 
+// gives up the CPU from kernel code, all registers and EFLAGS are preserved
+extern void yield(void);
+
+// where a forked child starts, returns 0 to user space from the parent's fork call
+extern void fork_return(void);
+
 extern uint32_t get_exec_ret_addr(void);
 
 extern void execute_return(uint8_t* execute_return_addr, uint32_t, uint32_t, uint8_t status);
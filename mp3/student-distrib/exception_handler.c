@@ -2,6 +2,7 @@
 #include "lib.h"
 #include "x86_desc.h"
 #include "interrupt_handler.h"
+#include "syscalls.h"
 
 /*
  * stop
@@ -54,7 +55,7 @@ void setup_exception_handlers(void){
     SET_IDT_ENTRY(idt[11], &handle_segment_missing);         //IDT 11
     SET_IDT_ENTRY(idt[12], &handle_stack_exception);         //IDT 12
     SET_IDT_ENTRY(idt[13], &handle_general_protection);      //IDT 13
-    SET_IDT_ENTRY(idt[14], &handle_page_fault);              //IDT 14
+    SET_IDT_ENTRY(idt[14], &page_fault_handler);             //IDT 14
     SET_IDT_ENTRY(idt[15], &handle_generic_error);           //IDT 15: Reserved
     SET_IDT_ENTRY(idt[16], &handle_fp_error);                //IDT 16
     SET_IDT_ENTRY(idt[17], &handle_alignment_check);         //IDT 17
@@ -269,15 +270,27 @@ void handle_general_protection(void){
 
 /*
  * handle_page_fault
- *   DESCRIPTION: Handle page fault exceptions
- *   INPUTS: none
+ *   DESCRIPTION: Handle page fault exceptions. Not-present faults in a process's
+ *                program window are demand paging and get the page filled in,
+ *                writes to shared read-only pages get a private copy, anything
+ *                else is fatal
+ *   INPUTS: error_code - pushed by the processor, addr - faulting address from CR2
  *   OUTPUT: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: print a blue screen error message and halt the system
+ *   SIDE EFFECTS: may map a page, otherwise print a blue screen error message and halt the system
  */
-void handle_page_fault(void){
+void handle_page_fault(uint32_t error_code, uint32_t addr){
+    if(!(error_code & PF_PROTECTION)){
+        if(fault_in_user_page(addr) == 0)
+            return;
+    }
+    else if(error_code & PF_WRITE){
+        if(fault_copy_on_write(addr) == 0)
+            return;
+    }
+
     blue_screen();
-    printf("Kernel Panic:\nPage Fault\nException Code: %x", __builtin_return_address(0));
+    printf("Kernel Panic:\nPage Fault\nAddress: %x\nException Code: %x", addr, error_code);
     stop();
 }
 
@@ -3,6 +3,10 @@
 
 #include "types.h"
 
+// page fault error code bits
+#define PF_PROTECTION 0x1   // the page was present (protection violation)
+#define PF_WRITE      0x2   // the access was a write
+
 //This simple function will just halt the system
 void stop(void);
 
@@ -24,7 +28,7 @@ void handle_invalid_tss(void);
 void handle_segment_missing(void);
 void handle_stack_exception(void);
 void handle_general_protection(void);
-void handle_page_fault();
+void handle_page_fault(uint32_t error_code, uint32_t addr);
 void handle_fp_error(void);
 void handle_alignment_check(void);
 void handle_machine_check(void);
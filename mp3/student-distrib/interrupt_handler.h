@@ -15,6 +15,8 @@ extern void key_handler(void);
 extern void trap_handler(void);
 /* This method acts as an assembly wrapper for scheduler */
 extern void scheduler_handler(void);
+/* This method acts as an assembly wrapper for page faults, passes the error code and faulting address */
+extern void page_fault_handler(void);
 
 extern void system_call_handler(void);
 
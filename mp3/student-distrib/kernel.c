@@ -18,8 +18,13 @@
 #include "types.h"
 #include "syscall_handler.h"
 #include "scheduler.h"
+#include "process.h"
+#include "page_alloc.h"
+#include "slab.h"
 
 static uint32_t filesys_ptr;
+static uint32_t filesys_end;
+static block_device_t filesys_device;
 
 // #define RUN_TESTS
 
@@ -68,8 +73,10 @@ void entry(unsigned long magic, unsigned long addr) {
         module_t* mod = (module_t*)mbi->mods_addr;
         while (mod_count < mbi->mods_count) {
             printf("Module %d loaded at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_start);
-            if (mod_count == 0)
+            if (mod_count == 0) {
               filesys_ptr = (uint32_t) mod->mod_start;
+              filesys_end = (uint32_t) mod->mod_end;
+            }
             printf("Module %d ends at address: 0x%#x\n", mod_count, (unsigned int)mod->mod_end);
             printf("First few bytes of module:\n");
             for (i = 0; i < 16; i++) {
@@ -179,9 +186,17 @@ void entry(unsigned long magic, unsigned long addr) {
     enable_irq(1);      //Enable keyboard interrupts
     enable_irq(8);      //Enable IRQ interrupts
 
-    /* Start up paging, see function for details */
+    /* Hand all usable memory to the frame allocator, then start up paging
+     * (it identity maps the part of memory the allocator gives the kernel) */
+    page_alloc_init(mbi);
     initPaging();
 
+    /* Set up the kernel heap on top of the frame allocator */
+    kmalloc_init();
+
+    /* Give the first terminal its scrollback history from the heap, the others get theirs when first shown */
+    init_scrollback();
+
     /* Enable interrupts */
     /* Do not enable the following until after you have set up your
      * IDT correctly otherwise QEMU will triple fault and simple close
@@ -189,8 +204,9 @@ void entry(unsigned long magic, unsigned long addr) {
 //    printf("Enabling Interrupts\n");
 //    sti();
 
-    /* init file system */
-    init_vfs(filesys_ptr);
+    /* init file system, on top of the module GRUB loaded it into */
+    memory_block_device_init(&filesys_device, (uint8_t *) filesys_ptr, filesys_end - filesys_ptr);
+    init_vfs(&filesys_device);
 
 #ifdef RUN_TESTS
     /* Run tests */
@@ -198,11 +214,13 @@ void entry(unsigned long magic, unsigned long addr) {
     enable_irq(1);
     sti();
 #endif
-    /* Execute the first program ("shell") ... */
-    while(1)
-    {
-      do_execute((uint8_t *) "shell");
-    }
-    /* Spin (nicely, so we don't chew up cycles) */
-    asm volatile (".1: hlt; jmp .1;");
+    /* Set up the PID allocator */
+    process_init();
+
+    /* Queue the first program ("shell") for terminal 0 ... */
+    launch_shell(0);
+
+    /* ... and become the idle task. The shell starts as soon as this yields,
+     * and from then on this thread only runs when nothing else can */
+    idle_task();
 }
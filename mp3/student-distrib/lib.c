@@ -6,6 +6,7 @@
 
 #define VIDEO       0xB8000
 static char* video_mem = (char *)VIDEO;
+static uint16_t display_start = 0;     //First cell of the screen the VGA is displaying
 
 /* void clear(void);
  * Inputs: void
@@ -24,14 +25,31 @@ void clear(void) {
  *   SIDE EFFECTS: Modifies video card, moves cursor
  */
 void move_cursor(uint16_t x, uint16_t y){
-  //Code is taken from OS_DEV
-  uint16_t position = y * NUM_COLS + x;
+  //Code is taken from OS_DEV, the cursor is placed relative to the screen being displayed
+  uint16_t position = display_start + y * NUM_COLS + x;
   outb(0x0F, VGA_PORT);                                      //0x0F, 0x0E are constants from OSDev
   outb((uint8_t) (position & 0xFF), VGA_PORT + 1);           //Write lower 8 bits of position
   outb(0x0E, VGA_PORT);                                      //0xFF is just used as a mask
   outb((uint8_t) ((position >> 8) & 0xFF), VGA_PORT + 1);    //write upper 8 bits of position
 }
 
+/*
+ * void set_display_page(uint8_t page)
+ *   DESCRIPTION: Points the VGA's start address at one of the screens in video memory.
+ *                Nothing is copied, the screen shown changes on the next refresh
+ *   INPUTS: page - which 4kB screen to display, below VGA_PAGES
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: Modifies video card, the cursor has to be placed again afterwards
+ */
+void set_display_page(uint8_t page){
+  display_start = page * VGA_PAGE_CELLS;
+  outb(0x0C, VGA_PORT);                                         //0x0C, 0x0D are the start address registers
+  outb((uint8_t) ((display_start >> 8) & 0xFF), VGA_PORT + 1);  //write upper 8 bits of the start
+  outb(0x0D, VGA_PORT);
+  outb((uint8_t) (display_start & 0xFF), VGA_PORT + 1);         //Write lower 8 bits of the start
+}
+
 /* void blue_screen(void);
  * Inputs: void
  * Return Value: none
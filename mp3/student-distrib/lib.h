@@ -16,6 +16,10 @@
 
 #define VGA_PORT 0x3D4
 
+//Text mode video memory at 0xB8000 is 32kB, eight screens of 4kB the VGA can display any one of
+#define VGA_PAGES      8
+#define VGA_PAGE_CELLS 0x800
+
 int32_t printf(int8_t *format, ...);
 void putc(uint8_t c);
 int32_t puts(int8_t *s);
@@ -27,6 +31,9 @@ void clear(void);
 // Places the text mode cursor at the specified location
 void move_cursor(uint16_t x, uint16_t y);
 
+// Makes the VGA display one of the screens in video memory
+void set_display_page(uint8_t page);
+
 /*Display kernel panic message */
 void blue_screen(void);
 
@@ -43,6 +50,17 @@ int8_t* strncpy(int8_t* dest, const int8_t*src, uint32_t n);
 int32_t bad_userspace_addr(const void* addr, int32_t len);
 int32_t safe_strncpy(int8_t* dest, const int8_t* src, int32_t n);
 
+/* Index of the lowest set bit in value, which must not be 0 */
+static inline uint32_t find_first_set(uint32_t value) {
+    uint32_t index;
+    asm volatile ("bsfl %1, %0"
+            : "=r"(index)
+            : "rm"(value)
+            : "cc"
+    );
+    return index;
+}
+
 /* Port read functions */
 /* Inb reads a byte and returns its value as a zero-extended 32-bit
  * unsigned int */
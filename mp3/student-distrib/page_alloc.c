@@ -0,0 +1,405 @@
+#include "page_alloc.h"
+#include "lib.h"
+
+/*
+ * Physical frame allocator. Memory is split into two zones: the direct mapped
+ * zone (8MB up to at most 128MB), which the kernel can read and write at its
+ * physical address, and everything above it, which is only handed to user
+ * programs. Each zone is a binary buddy allocator whose free lists are bitmaps,
+ * one per order, where a set bit means that block is free and not merged into
+ * a larger block. Zones start on a 4MB boundary so every block is naturally
+ * aligned.
+ */
+
+#define MB_4 0x400000
+#define MB_1 0x100000
+#define KB_1 0x400
+#define MMAP_AVAILABLE 1
+// a zone of n 4MB blocks needs n * 2047 bits across all orders, plus rounding per order
+#define ZONE_BITMAP_WORDS(n) ((n) * 64 + MAX_ORDER + 1)
+#define LOWMEM_MAX_BLOCKS ((DIRECT_MAP_LIMIT - PHYS_ALLOC_BASE) / MB_4)
+#define HIGHMEM_MAX_BLOCKS ((PHYS_MEM_LIMIT - PHYS_ALLOC_BASE) / MB_4)
+
+typedef struct zone_t {
+    uint32_t base;                          // physical address of block 0, 4MB aligned
+    uint32_t end;                           // first address past the zone
+    uint32_t * bitmap[MAX_ORDER + 1];       // free bits for each order
+    uint32_t num_blocks[MAX_ORDER + 1];     // number of whole blocks of each order in the zone
+    uint32_t free_blocks[MAX_ORDER + 1];    // number of set bits in each bitmap
+} zone_t;
+
+static zone_t lowmem;
+static zone_t highmem;
+static uint32_t lowmem_bits[ZONE_BITMAP_WORDS(LOWMEM_MAX_BLOCKS)];
+static uint32_t highmem_bits[ZONE_BITMAP_WORDS(HIGHMEM_MAX_BLOCKS)];
+static uint32_t direct_map_end = PHYS_ALLOC_BASE;
+static multiboot_info_t * boot_info;
+// extra mappings of each 4KB frame above PHYS_ALLOC_BASE, 0 while a frame has a single owner
+static uint8_t * frame_refs;
+static uint32_t num_frames;
+
+/*
+ * zone_init
+ *   DESCRIPTION: lays out a zone's bitmaps in its storage with every block in use
+ *   INPUTS: zone - the zone, base/end - its physical range, storage - bitmap words
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the zone
+ */
+static void zone_init(zone_t * zone, uint32_t base, uint32_t end, uint32_t * storage){
+    uint32_t order, words;
+
+    zone->base = base;
+    zone->end = end;
+    for(order = 0; order <= MAX_ORDER; order++){
+        zone->num_blocks[order] = (end > base) ? (end - base) >> (PAGE_SHIFT + order) : 0;
+        zone->free_blocks[order] = 0;
+        zone->bitmap[order] = storage;
+        words = (zone->num_blocks[order] + 31) / 32;
+        memset(storage, 0, words * 4);
+        storage += words;
+    }
+}
+
+static inline uint32_t test_block(zone_t * zone, uint32_t order, uint32_t index){
+    return zone->bitmap[order][index / 32] & (1 << (index % 32));
+}
+
+static inline void set_block(zone_t * zone, uint32_t order, uint32_t index){
+    zone->bitmap[order][index / 32] |= (1 << (index % 32));
+    zone->free_blocks[order]++;
+}
+
+static inline void clear_block(zone_t * zone, uint32_t order, uint32_t index){
+    zone->bitmap[order][index / 32] &= ~(1 << (index % 32));
+    zone->free_blocks[order]--;
+}
+
+/*
+ * zone_alloc
+ *   DESCRIPTION: takes the first free block of the smallest order that fits and
+ *                splits it down, freeing the upper halves along the way
+ *   INPUTS: zone - zone to allocate from, order - log2 of the number of frames
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of the block, 0 if the zone has nothing big enough
+ *   SIDE EFFECTS: modifies the zone's bitmaps
+ */
+static uint32_t zone_alloc(zone_t * zone, uint32_t order){
+    uint32_t current, word, index;
+
+    for(current = order; current <= MAX_ORDER; current++){
+        if(zone->free_blocks[current] != 0)
+            break;
+    }
+    if(current > MAX_ORDER)
+        return 0;
+
+    for(word = 0; zone->bitmap[current][word] == 0; word++);
+    index = word * 32 + find_first_set(zone->bitmap[current][word]);
+    clear_block(zone, current, index);
+
+    while(current > order){
+        current--;
+        index *= 2;
+        set_block(zone, current, index + 1);    //upper half becomes a free buddy
+    }
+    return zone->base + (index << (PAGE_SHIFT + order));
+}
+
+/*
+ * zone_free
+ *   DESCRIPTION: frees a block, merging it with its buddy as long as the buddy is free
+ *   INPUTS: zone - zone the block is in, addr - its physical address, order - its size
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the zone's bitmaps
+ */
+static void zone_free(zone_t * zone, uint32_t addr, uint32_t order){
+    uint32_t index = (addr - zone->base) >> (PAGE_SHIFT + order);
+    uint32_t buddy;
+
+    while(order < MAX_ORDER){
+        buddy = index ^ 1;
+        if(buddy >= zone->num_blocks[order] || !test_block(zone, order, buddy))
+            break;
+        clear_block(zone, order, buddy);
+        index >>= 1;
+        order++;
+    }
+    set_block(zone, order, index);
+}
+
+/*
+ * zone_free_range
+ *   DESCRIPTION: frees every whole frame of a physical range that lies in a zone,
+ *                in the largest aligned blocks possible
+ *   INPUTS: zone - the zone, start/end - the physical range
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the zone's bitmaps
+ */
+static void zone_free_range(zone_t * zone, uint32_t start, uint32_t end){
+    uint32_t order;
+
+    if(start < zone->base) start = zone->base;
+    if(end > zone->end) end = zone->end;
+    start = (start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    end &= ~(PAGE_SIZE - 1);
+
+    while(start < end){
+        order = MAX_ORDER;
+        while(((start - zone->base) & ((PAGE_SIZE << order) - 1)) != 0 || start + (PAGE_SIZE << order) > end)
+            order--;
+        zone_free(zone, start, order);
+        start += PAGE_SIZE << order;
+    }
+}
+
+/*
+ * free_usable_range
+ *   DESCRIPTION: hands a range of usable RAM to the zones, leaving out the
+ *                multiboot modules (the filesystem image) wherever they are
+ *   INPUTS: start/end - the physical range
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the zones
+ */
+static void free_usable_range(uint32_t start, uint32_t end){
+    uint32_t i;
+    module_t * mod;
+
+    if(start < PHYS_ALLOC_BASE) start = PHYS_ALLOC_BASE;
+    if(start >= end) return;
+
+    if(boot_info->flags & (1 << 3)){
+        mod = (module_t *) boot_info->mods_addr;
+        for(i = 0; i < boot_info->mods_count; i++, mod++){
+            if(mod->mod_start < end && mod->mod_end > start){
+                free_usable_range(start, mod->mod_start);
+                free_usable_range(mod->mod_end, end);
+                return;
+            }
+        }
+    }
+
+    zone_free_range(&lowmem, start, end);
+    zone_free_range(&highmem, start, end);
+}
+
+/*
+ * mmap_range
+ *   DESCRIPTION: clips a multiboot memory map entry to the 32-bit range we manage
+ *   INPUTS: mmap - the entry, start/end - where to store the range
+ *   OUTPUTS: start and end
+ *   RETURN VALUE: 1 if the entry is usable RAM below PHYS_MEM_LIMIT, 0 otherwise
+ *   SIDE EFFECTS: none
+ */
+static uint32_t mmap_range(memory_map_t * mmap, uint32_t * start, uint32_t * end){
+    if(mmap->type != MMAP_AVAILABLE || mmap->base_addr_high != 0 || mmap->base_addr_low >= PHYS_MEM_LIMIT)
+        return 0;
+    *start = mmap->base_addr_low;
+    if(mmap->length_high != 0 || mmap->length_low > PHYS_MEM_LIMIT - *start)
+        *end = PHYS_MEM_LIMIT;
+    else
+        *end = *start + mmap->length_low;
+    return 1;
+}
+
+/*
+ * page_alloc_init
+ *   DESCRIPTION: finds the top of RAM, splits memory into the direct mapped and
+ *                user-only zones and frees every usable frame into them. Falls
+ *                back to mem_upper when there is no memory map
+ *   INPUTS: mbi - multiboot information from the boot loader
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets up both zones and direct_map_end
+ */
+void page_alloc_init(multiboot_info_t * mbi){
+    memory_map_t * mmap;
+    uint32_t start, end, order, ram_top = 0;
+    uint32_t has_mmap = mbi->flags & (1 << 6);
+
+    boot_info = mbi;
+
+    //First pass: how far up does RAM go
+    if(has_mmap){
+        for(mmap = (memory_map_t *) mbi->mmap_addr;
+                (uint32_t) mmap < mbi->mmap_addr + mbi->mmap_length;
+                mmap = (memory_map_t *) ((uint32_t) mmap + mmap->size + sizeof(mmap->size))){
+            if(mmap_range(mmap, &start, &end) && end > ram_top)
+                ram_top = end;
+        }
+    }
+    else if(mbi->flags & 1){
+        ram_top = MB_1 + mbi->mem_upper * KB_1;
+    }
+
+    direct_map_end = ram_top & ~(MB_4 - 1);
+    if(direct_map_end > DIRECT_MAP_LIMIT) direct_map_end = DIRECT_MAP_LIMIT;
+    if(direct_map_end < PHYS_ALLOC_BASE) direct_map_end = PHYS_ALLOC_BASE;
+
+    zone_init(&lowmem, PHYS_ALLOC_BASE, direct_map_end, lowmem_bits);
+    zone_init(&highmem, direct_map_end, (ram_top > direct_map_end) ? ram_top : direct_map_end, highmem_bits);
+
+    //Second pass: free everything usable
+    if(has_mmap){
+        for(mmap = (memory_map_t *) mbi->mmap_addr;
+                (uint32_t) mmap < mbi->mmap_addr + mbi->mmap_length;
+                mmap = (memory_map_t *) ((uint32_t) mmap + mmap->size + sizeof(mmap->size))){
+            if(mmap_range(mmap, &start, &end))
+                free_usable_range(start, end);
+        }
+    }
+    else{
+        free_usable_range(MB_1, ram_top);
+    }
+
+    //Share counts for copy-on-write, kept in the direct mapped zone
+    num_frames = (highmem.end - PHYS_ALLOC_BASE) >> PAGE_SHIFT;
+    for(order = 0; (PAGE_SIZE << order) < num_frames; order++);
+    frame_refs = (uint8_t *) alloc_pages(ALLOC_KERNEL, order);
+    if(frame_refs != NULL)
+        memset(frame_refs, 0, num_frames);
+}
+
+/*
+ * alloc_pages
+ *   DESCRIPTION: allocates a naturally aligned block of 2^order frames
+ *   INPUTS: where - ALLOC_KERNEL or ALLOC_USER, order - 0 for 4KB up to MAX_ORDER for 4MB
+ *   OUTPUTS: none
+ *   RETURN VALUE: physical address of the block, 0 if out of memory
+ *   SIDE EFFECTS: modifies the zones
+ */
+uint32_t alloc_pages(uint32_t where, uint32_t order){
+    uint32_t flags, addr = 0;
+
+    if(order > MAX_ORDER)
+        return 0;
+
+    cli_and_save(flags);
+    //Keep the direct mapped zone for things only the kernel can allocate
+    if(where == ALLOC_USER)
+        addr = zone_alloc(&highmem, order);
+    if(addr == 0)
+        addr = zone_alloc(&lowmem, order);
+    restore_flags(flags);
+    return addr;
+}
+
+/*
+ * free_pages
+ *   DESCRIPTION: returns a block to the zone it came from. Only touches the
+ *                bitmaps, so it is safe to free the stack we are running on
+ *   INPUTS: addr - physical address from alloc_pages, order - the order it was allocated with
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the zones
+ */
+void free_pages(uint32_t addr, uint32_t order){
+    uint32_t flags;
+
+    if(addr < PHYS_ALLOC_BASE || order > MAX_ORDER)
+        return;
+
+    cli_and_save(flags);
+    if(addr < lowmem.end)
+        zone_free(&lowmem, addr, order);
+    else if(addr < highmem.end)
+        zone_free(&highmem, addr, order);
+    restore_flags(flags);
+}
+
+/*
+ * get_page
+ *   DESCRIPTION: records that one more address space maps a user frame
+ *   INPUTS: addr - physical address of a 4KB frame from alloc_pages
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if the frame's sharing cannot be tracked
+ *   SIDE EFFECTS: modifies frame_refs
+ */
+int32_t get_page(uint32_t addr){
+    uint32_t flags;
+    uint8_t * refs;
+
+    if(frame_refs == NULL || addr < PHYS_ALLOC_BASE || ((addr - PHYS_ALLOC_BASE) >> PAGE_SHIFT) >= num_frames)
+        return -1;
+    refs = &frame_refs[(addr - PHYS_ALLOC_BASE) >> PAGE_SHIFT];
+
+    cli_and_save(flags);
+    if(*refs == 0xFF){
+        restore_flags(flags);
+        return -1;
+    }
+    (*refs)++;
+    restore_flags(flags);
+    return 0;
+}
+
+/*
+ * put_page
+ *   DESCRIPTION: drops one mapping of a user frame and frees it if that was the last
+ *   INPUTS: addr - physical address of a 4KB frame from alloc_pages
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies frame_refs and the zones
+ */
+void put_page(uint32_t addr){
+    uint32_t flags;
+    uint8_t * refs;
+
+    //never shared if we cannot count it
+    if(frame_refs == NULL || addr < PHYS_ALLOC_BASE || ((addr - PHYS_ALLOC_BASE) >> PAGE_SHIFT) >= num_frames){
+        free_pages(addr, 0);
+        return;
+    }
+    refs = &frame_refs[(addr - PHYS_ALLOC_BASE) >> PAGE_SHIFT];
+
+    cli_and_save(flags);
+    if(*refs != 0)
+        (*refs)--;
+    else
+        free_pages(addr, 0);
+    restore_flags(flags);
+}
+
+/*
+ * page_is_shared
+ *   DESCRIPTION: tells copy-on-write whether a frame can just be made writable
+ *   INPUTS: addr - physical address of a 4KB frame from alloc_pages
+ *   OUTPUTS: none
+ *   RETURN VALUE: nonzero if more than one address space maps the frame
+ *   SIDE EFFECTS: none
+ */
+uint32_t page_is_shared(uint32_t addr){
+    if(frame_refs == NULL || addr < PHYS_ALLOC_BASE || ((addr - PHYS_ALLOC_BASE) >> PAGE_SHIFT) >= num_frames)
+        return 0;
+    return frame_refs[(addr - PHYS_ALLOC_BASE) >> PAGE_SHIFT];
+}
+
+/*
+ * get_direct_map_end
+ *   DESCRIPTION: tells paging how much physical memory to identity map
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: first physical address past the direct mapped zone
+ *   SIDE EFFECTS: none
+ */
+uint32_t get_direct_map_end(void){
+    return direct_map_end;
+}
+
+/*
+ * free_page_count
+ *   DESCRIPTION: counts free memory
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of free 4KB frames in both zones
+ *   SIDE EFFECTS: none
+ */
+uint32_t free_page_count(void){
+    uint32_t order, count = 0;
+    for(order = 0; order <= MAX_ORDER; order++)
+        count += (lowmem.free_blocks[order] + highmem.free_blocks[order]) << order;
+    return count;
+}
@@ -0,0 +1,47 @@
+#ifndef PAGE_ALLOC_H_
+#define PAGE_ALLOC_H_
+
+#include "types.h"
+#include "multiboot.h"
+
+#define PAGE_SIZE 0x1000
+#define PAGE_SHIFT 12
+// largest block is 4KB << 10 = 4MB, the size of a large page
+#define MAX_ORDER 10
+
+// everything below 8MB belongs to the kernel image, the filesystem module and kernel stacks
+#define PHYS_ALLOC_BASE 0x800000
+// the kernel identity maps physical memory up to here, user space starts at virtual 128MB
+#define DIRECT_MAP_LIMIT 0x8000000
+// memory past here is ignored to keep the bitmaps small
+#define PHYS_MEM_LIMIT 0x40000000
+
+// where alloc_pages may take memory from
+#define ALLOC_KERNEL 0    // must be identity mapped so the kernel can touch it
+#define ALLOC_USER   1    // only ever touched through user mappings, prefer memory past the direct map
+
+/* Seeds the buddy allocator with the usable memory in the multiboot memory map */
+void page_alloc_init(multiboot_info_t * mbi);
+
+/* Allocates 2^order contiguous, naturally aligned 4KB frames, returns the physical address or 0 */
+uint32_t alloc_pages(uint32_t where, uint32_t order);
+
+/* Returns a block from alloc_pages, order must match the allocation */
+void free_pages(uint32_t addr, uint32_t order);
+
+/* Adds a mapping to a user frame that is shared between address spaces */
+int32_t get_page(uint32_t addr);
+
+/* Drops a mapping of a user frame, the frame is freed with its last mapping */
+void put_page(uint32_t addr);
+
+/* Whether more than one address space maps a user frame */
+uint32_t page_is_shared(uint32_t addr);
+
+/* End of the identity mapped physical memory, a multiple of 4MB */
+uint32_t get_direct_map_end(void);
+
+/* Number of free 4KB frames across all zones */
+uint32_t free_page_count(void);
+
+#endif
@@ -1,39 +1,58 @@
 #include "paging.h"
+#include "page_alloc.h"
+#include "lib.h"
 
 #define VMEM_BASE 184
-#define VMEM_TOP 187
+#define VMEM_TOP 191
+#define PDE_SHIFT 22
+#define PTE_SHIFT 12
+#define PTE_INDEX_MASK 0x3FF
 
-//define page directories array, align each to 4kB
-uint32_t page_directory_array[NUM_MAX_PROCESSES][NUM_ENTRIES] __attribute__((aligned(4096)));
+/* invlpg
+ * description: drops one page from the TLB
+ * inputs: vaddr - virtual address in the page
+ * outputs: none
+ * return value: none
+ * side effects: flushes a TLB entry
+ */
+static inline void invlpg(uint32_t vaddr)
+{
+	asm volatile("invlpg (%0)" : : "r" (vaddr) : "memory");
+	paging_stats.tlb_page_flushes++;
+}
+
+//kernel page directory, align to 4kB
+uint32_t kernel_page_directory[NUM_ENTRIES] __attribute__((aligned(4096)));
 
 //0-4MB page table array, align each to 4kB
 uint32_t first_page_table[NUM_ENTRIES] __attribute__((aligned(4096)));
 
-//128-132MB page table array for vidmap, align each to 4kB
-uint32_t video_mem_page_table[NUM_MAX_PROCESSES][NUM_ENTRIES] __attribute__((aligned(4096)));
+paging_stats_t paging_stats;
+
+//directory in cr3, only changed through loadPageDirectory calls in this file
+static uint32_t * loaded_page_directory;
 
 
 /* initPaging
  * description: The main function to set up everything needed for paging
- * inputs: unsigned long * - pointer to page directory
+ * inputs: none
  * outputs: none
- * return value: noned
- * side effects: inits a page dir, loads it, enables paging
+ * return value: none
+ * side effects: inits the kernel page dir, loads it, enables paging
  */
 void initPaging()
 {
 	//initialize each entry to not present
-	int i, j;
+	int i;
+	uint32_t direct_map_end = get_direct_map_end();
 
-	for (i = 0; i < NUM_MAX_PROCESSES; i++){
-		for(j = 0; j < NUM_ENTRIES; j++)
-		{
-		  // This sets the following flags to the pages:
-		  //   Supervisor: Only kernel-mode can access them
-		  //   Write Enabled: It can be both read from and written to
-		  //   Not Present: The page table is not present
-		  page_directory_array[i][j] = 0x00000002;
-		}
+	for(i = 0; i < NUM_ENTRIES; i++)
+	{
+	  // This sets the following flags to the pages:
+	  //   Supervisor: Only kernel-mode can access them
+	  //   Write Enabled: It can be both read from and written to
+	  //   Not Present: The page table is not present
+	  kernel_page_directory[i] = PAGE_RW;
 	}
 
 	//initialize first page table containing video memory
@@ -42,7 +61,7 @@ void initPaging()
 		// As the address is page aligned, it will always leave 12 bits zeroed.
 		// Those bits are used by the attributes ;)
 		if (i >= VMEM_BASE && i <= VMEM_TOP){
-			first_page_table[i] = (i * 0x1000) | 3; // attributes: supervisor level, read/write, present.
+			first_page_table[i] = (i * 0x1000) | PAGE_GLOBAL | 3; // attributes: global, supervisor level, read/write, present.
 		}
 		//map other virtual address as not present
 		else{
@@ -50,28 +69,321 @@ void initPaging()
 		}
 	}
 
+	// set first entry in page directory to point to first page table
+	kernel_page_directory[0] = ((unsigned int) first_page_table) | 3;
 
-	// set first entry in first page directory to point to first page table
-	page_directory_array[0][0] = ((unsigned int) first_page_table) | 3;
+	// set second entry in page directory to point to the kernel page
+	// 3 for supervisor, R/W and present bit set
+	// 8 for 4MB page size for that entry
+	// 1 for global, the kernel page is the same in every address space
+	// 4 for starting at address 0x400000 (corresponds to 4MB starting location for kernel page)
+	kernel_page_directory[1] = 0x00400183;
 
-	for (i = 0; i < NUM_MAX_PROCESSES; i++){
-		//Try setting the first page table in each page directory to first page table
-		//Hopefully allows for reading/writing to video memory
-		page_directory_array[i][0] = ((unsigned int) first_page_table) | 3;
-
-		// set second entry in page directories to point to second page table
-		// 7 for supervisor, R/W and present bit set
-		// 8 for 4MB page size for that entry
-		// 4 for starting at address 0x400000 (corresponds to 4MB starting location for kernel page)
-		page_directory_array[i][1] = 0x00400083;
-
-		//map virtual 128 MB to physical 8MB + (i * 4MB) where i is the page directory #
-		//32 because it corresponds with 128 MB virtual address
-		page_directory_array[i][32] = 0x00800087 + i * 0x00400000;
+	// identity map the memory the frame allocator hands to the kernel, with
+	// supervisor 4MB pages, so page tables and kernel stacks can be used in place
+	for (i = 2; i < (direct_map_end >> PDE_SHIFT); i++){
+		kernel_page_directory[i] = (i << PDE_SHIFT) | PAGE_GLOBAL | PAGE_4MB | PAGE_RW | PAGE_PRESENT;
 	}
 
 	// set control registers to initialize paging
-	loadPageDirectory(page_directory_array[0]); // set cr3 to point to first page directory
+	loadPageDirectory(kernel_page_directory); // set cr3 to point to kernel page directory
+	loaded_page_directory = kernel_page_directory;
 	setPageSize(); // set cr4
 	enablePaging(); // set cr0
 }
+
+/* switch_page_directory
+ * description: moves to another address space. Tasks that run on the directory
+ *              that is already loaded (the idle task leaves the last one in
+ *              place) skip the cr3 load and keep their TLB entries
+ * inputs: page_directory - directory to run on
+ * outputs: none
+ * return value: none
+ * side effects: may load cr3, updates paging_stats
+ */
+void switch_page_directory(uint32_t * page_directory)
+{
+	if (page_directory == loaded_page_directory){
+		paging_stats.cr3_loads_skipped++;
+		return;
+	}
+	loadPageDirectory(page_directory);
+	loaded_page_directory = page_directory;
+	paging_stats.cr3_loads++;
+	paging_stats.tlb_flushes++;
+}
+
+/* flush_tlb
+ * description: drops every non-global TLB entry after page tables of the loaded
+ *              directory changed in more than one place
+ * inputs: none
+ * outputs: none
+ * return value: none
+ * side effects: reloads cr3, updates paging_stats
+ */
+void flush_tlb()
+{
+	flushTLB();
+	paging_stats.tlb_flushes++;
+}
+
+/* print_paging_stats
+ * description: prints the address space switch and TLB counters
+ * inputs: none
+ * outputs: prints to the screen
+ * return value: none
+ * side effects: none
+ */
+void print_paging_stats()
+{
+	printf("cr3 loads: %d, skipped: %d, tlb flushes: %d, page flushes: %d\n",
+	       paging_stats.cr3_loads, paging_stats.cr3_loads_skipped,
+	       paging_stats.tlb_flushes, paging_stats.tlb_page_flushes);
+}
+
+/* create_page_directory
+ * description: makes an empty address space for a process that shares the
+ *              kernel's mappings below 128MB
+ * inputs: none
+ * outputs: none
+ * return value: new page directory, NULL if out of memory
+ * side effects: allocates a frame
+ */
+uint32_t * create_page_directory()
+{
+	int i;
+	uint32_t * page_directory = (uint32_t *) alloc_pages(ALLOC_KERNEL, 0);
+
+	if (page_directory == NULL)
+		return NULL;
+
+	for (i = 0; i < USER_PDE_START; i++)
+		page_directory[i] = kernel_page_directory[i];
+	for (i = USER_PDE_START; i < NUM_ENTRIES; i++)
+		page_directory[i] = PAGE_RW;
+	return page_directory;
+}
+
+/* destroy_page_directory
+ * description: tears down a process's address space
+ * inputs: page_directory - directory from create_page_directory, must not be loaded
+ * outputs: none
+ * return value: none
+ * side effects: frees the directory, its page tables and every PAGE_OWNED frame
+ *               no other directory still shares
+ */
+void destroy_page_directory(uint32_t * page_directory)
+{
+	int i, j;
+	uint32_t * page_table;
+
+	for (i = USER_PDE_START; i < NUM_ENTRIES; i++){
+		if (!(page_directory[i] & PAGE_PRESENT))
+			continue;
+		page_table = (uint32_t *) (page_directory[i] & PAGE_ADDR_MASK);
+		for (j = 0; j < NUM_ENTRIES; j++){
+			// frames we did not allocate (video memory) are left alone
+			if ((page_table[j] & (PAGE_PRESENT | PAGE_OWNED)) == (PAGE_PRESENT | PAGE_OWNED))
+				put_page(page_table[j] & PAGE_ADDR_MASK);
+		}
+		free_pages((uint32_t) page_table, 0);
+	}
+	free_pages((uint32_t) page_directory, 0);
+}
+
+/* clone_page_directory
+ * description: copies an address space for fork. Page tables are duplicated,
+ *              frames are shared: every writable frame becomes read-only
+ *              copy-on-write in both directories
+ * inputs: page_directory - the directory to copy, must be the loaded one
+ * outputs: none
+ * return value: the new directory, NULL if out of memory
+ * side effects: write protects the parent's pages and flushes the TLB
+ */
+uint32_t * clone_page_directory(uint32_t * page_directory)
+{
+	int i, j;
+	uint32_t entry;
+	uint32_t * child = create_page_directory();
+	uint32_t * page_table;
+	uint32_t * child_table;
+
+	if (child == NULL)
+		return NULL;
+
+	for (i = USER_PDE_START; i < NUM_ENTRIES; i++){
+		if (!(page_directory[i] & PAGE_PRESENT))
+			continue;
+		child_table = (uint32_t *) alloc_pages(ALLOC_KERNEL, 0);
+		if (child_table == NULL){
+			destroy_page_directory(child);
+			flush_tlb();
+			return NULL;
+		}
+		memset(child_table, 0, NUM_ENTRIES * sizeof(uint32_t));
+		child[i] = ((uint32_t) child_table) | (page_directory[i] & PAGE_FLAGS_MASK);
+
+		page_table = (uint32_t *) (page_directory[i] & PAGE_ADDR_MASK);
+		for (j = 0; j < NUM_ENTRIES; j++){
+			entry = page_table[j];
+			// frames we did not allocate (video memory, the filesystem image) are shared as is
+			if ((entry & (PAGE_PRESENT | PAGE_OWNED)) == (PAGE_PRESENT | PAGE_OWNED)){
+				if (get_page(entry & PAGE_ADDR_MASK) == -1){
+					destroy_page_directory(child);
+					flush_tlb();
+					return NULL;
+				}
+				if (entry & PAGE_RW){
+					entry = (entry & ~PAGE_RW) | PAGE_COW;
+					page_table[j] = entry;
+				}
+			}
+			child_table[j] = entry;
+		}
+	}
+
+	flush_tlb();
+	return child;
+}
+
+/* get_page_table
+ * description: finds the page table covering a user address
+ * inputs: page_directory - directory to look in, vaddr - user virtual address,
+ *         create - whether to allocate the page table if it is missing
+ * outputs: none
+ * return value: the page table, NULL if missing or out of memory
+ * side effects: may allocate a frame and modify the directory
+ */
+uint32_t * get_page_table(uint32_t * page_directory, uint32_t vaddr, int32_t create)
+{
+	uint32_t pde = vaddr >> PDE_SHIFT;
+	uint32_t * page_table;
+
+	if (page_directory[pde] & PAGE_PRESENT)
+		return (uint32_t *) (page_directory[pde] & PAGE_ADDR_MASK);
+	if (!create)
+		return NULL;
+
+	// page tables come from the direct mapped zone so we can fill them in here
+	page_table = (uint32_t *) alloc_pages(ALLOC_KERNEL, 0);
+	if (page_table == NULL)
+		return NULL;
+	memset(page_table, 0, NUM_ENTRIES * sizeof(uint32_t));
+	page_directory[pde] = ((uint32_t) page_table) | PAGE_USER | PAGE_RW | PAGE_PRESENT;
+	return page_table;
+}
+
+/* unmap_page_table
+ * description: removes a whole 4MB region of user mappings, like one mmap area
+ * inputs: page_directory - directory to unmap from, vaddr - user address in the region
+ * outputs: none
+ * return value: none
+ * side effects: puts every PAGE_OWNED frame, frees the page table, does not flush the TLB
+ */
+void unmap_page_table(uint32_t * page_directory, uint32_t vaddr)
+{
+	uint32_t pde = vaddr >> PDE_SHIFT;
+	uint32_t * page_table = get_page_table(page_directory, vaddr, 0);
+	int j;
+
+	if (page_table == NULL)
+		return;
+	for (j = 0; j < NUM_ENTRIES; j++){
+		if ((page_table[j] & (PAGE_PRESENT | PAGE_OWNED)) == (PAGE_PRESENT | PAGE_OWNED))
+			put_page(page_table[j] & PAGE_ADDR_MASK);
+	}
+	page_directory[pde] = 0;
+	free_pages((uint32_t) page_table, 0);
+}
+
+/* map_page
+ * description: points one user virtual page at a physical frame
+ * inputs: page_directory - directory to map in, vaddr - user virtual address,
+ *         paddr - physical frame, flags - PTE flags
+ * outputs: none
+ * return value: 0 on success, -1 if a page table could not be allocated
+ * side effects: modifies the page tables, does not flush the TLB
+ */
+int32_t map_page(uint32_t * page_directory, uint32_t vaddr, uint32_t paddr, uint32_t flags)
+{
+	uint32_t * page_table = get_page_table(page_directory, vaddr, 1);
+
+	if (page_table == NULL)
+		return -1;
+	page_table[(vaddr >> PTE_SHIFT) & PTE_INDEX_MASK] = (paddr & PAGE_ADDR_MASK) | flags;
+	return 0;
+}
+
+/* kmap
+ * description: temporarily maps a frame into kernel space, for frames outside
+ *              the direct mapped zone
+ * inputs: frame - physical address of a 4KB frame
+ * outputs: none
+ * return value: kernel virtual address of the frame, valid until kunmap
+ * side effects: uses the single KMAP_VADDR slot, interrupts must stay off until kunmap
+ */
+void * kmap(uint32_t frame)
+{
+	first_page_table[(KMAP_VADDR >> PTE_SHIFT) & PTE_INDEX_MASK] = (frame & PAGE_ADDR_MASK) | PAGE_RW | PAGE_PRESENT;
+	invlpg(KMAP_VADDR);
+	return (void *) KMAP_VADDR;
+}
+
+/* kunmap
+ * description: releases the kmap slot
+ * inputs: none
+ * outputs: none
+ * return value: none
+ * side effects: clears the KMAP_VADDR slot
+ */
+void kunmap()
+{
+	first_page_table[(KMAP_VADDR >> PTE_SHIFT) & PTE_INDEX_MASK] = PAGE_RW;
+	invlpg(KMAP_VADDR);
+}
+
+/* copy_on_write
+ * description: gives a process its own writable copy of a shared read-only page.
+ *              The old contents are read through the faulting user address, the
+ *              new frame is filled through kmap so it can come from any zone
+ * inputs: page_directory - the loaded directory, vaddr - user address that took a write fault
+ * outputs: none
+ * return value: 0 if the page now has a private writable copy, -1 if it is not a COW page or out of memory
+ * side effects: allocates a frame, modifies the page table
+ */
+int32_t copy_on_write(uint32_t * page_directory, uint32_t vaddr)
+{
+	uint32_t * page_table = get_page_table(page_directory, vaddr, 0);
+	uint32_t * entry;
+	uint32_t frame, flags;
+
+	if (page_table == NULL)
+		return -1;
+	entry = &page_table[(vaddr >> PTE_SHIFT) & PTE_INDEX_MASK];
+	if ((*entry & (PAGE_PRESENT | PAGE_COW)) != (PAGE_PRESENT | PAGE_COW))
+		return -1;
+
+	cli_and_save(flags);
+	// the other sharers already copied or exited, the frame is ours to write
+	if ((*entry & PAGE_OWNED) && !page_is_shared(*entry & PAGE_ADDR_MASK)){
+		*entry = (*entry & ~PAGE_COW) | PAGE_RW;
+		invlpg(vaddr);
+		restore_flags(flags);
+		return 0;
+	}
+
+	frame = alloc_pages(ALLOC_USER, 0);
+	if (frame == 0){
+		restore_flags(flags);
+		return -1;
+	}
+
+	memcpy(kmap(frame), (void *) (vaddr & PAGE_ADDR_MASK), PAGE_SIZE);
+	kunmap();
+	if (*entry & PAGE_OWNED)
+		put_page(*entry & PAGE_ADDR_MASK);
+	*entry = frame | PAGE_OWNED | PAGE_USER | PAGE_RW | PAGE_PRESENT;
+	invlpg(vaddr);
+	restore_flags(flags);
+	return 0;
+}
@@ -3,21 +3,45 @@
 
 #include "types.h"
 
-//maximum number of processes
-#define NUM_MAX_PROCESSES 6
+//maximum number of processes, PIDs are handed out from a bitmap in process.c
+#define NUM_MAX_PROCESSES 64
 
 // number of entries in page directory and page table
 #define NUM_ENTRIES  1024
 
-// declare global page directory
-extern uint32_t page_directory_array[NUM_MAX_PROCESSES][NUM_ENTRIES];
+// page directory and page table entry flags
+#define PAGE_PRESENT 0x1
+#define PAGE_RW      0x2
+#define PAGE_USER    0x4
+#define PAGE_4MB     0x80
+#define PAGE_GLOBAL  0x100    // kernel mappings, identical in every directory, kept in the TLB across CR3 loads
+#define PAGE_OWNED   0x200    // available bit: the frame came from alloc_pages and goes back on teardown
+#define PAGE_COW     0x400    // available bit: read-only shared page, copied on the first write
+#define PAGE_ADDR_MASK 0xFFFFF000
+#define PAGE_FLAGS_MASK 0xFFF
+
+// virtual page in the shared 0-4MB page table used to reach frames the kernel does not map
+#define KMAP_VADDR 0x3FF000
+
+// directory entries from here up (virtual 128MB) belong to the process, the rest are shared kernel mappings
+#define USER_PDE_START 32
+
+// address space switch and TLB counters
+typedef struct paging_stats_t {
+	uint32_t cr3_loads;          // page directory switches that reloaded CR3
+	uint32_t cr3_loads_skipped;  // switches to the directory that was already loaded
+	uint32_t tlb_flushes;        // full (non-global) TLB flushes, CR3 loads included
+	uint32_t tlb_page_flushes;   // single page invalidations
+} paging_stats_t;
+
+extern paging_stats_t paging_stats;
+
+// page directory used at boot and by the idle task, every process directory copies its kernel half
+extern uint32_t kernel_page_directory[NUM_ENTRIES];
 
 // declare global page table mapping from virtual 0MB to physical 0MB
 extern uint32_t first_page_table[NUM_ENTRIES];
 
-// declare global page table mapping from virtual 256MB to physical 0MB
-extern uint32_t video_mem_page_table[NUM_MAX_PROCESSES][NUM_ENTRIES];
-
 /* loadPageDirectory
  * inputs: unsigned long * - pointer to page directory
  * outputs: none
@@ -26,11 +50,19 @@ extern uint32_t video_mem_page_table[NUM_MAX_PROCESSES][NUM_ENTRIES];
  */
 extern void loadPageDirectory(uint32_t * arg);
 
+/* flushTLB
+ * inputs: none
+ * outputs: none
+ * return value: none
+ * side effects: reloads cr3 with its current value, flushing the TLB
+ */
+extern void flushTLB();
+
 /* setPageSize
  * inputs: none
  * outputs: none
  * return value: none
- * side effects: sets cr4 (PSE and clears PAE)
+ * side effects: sets cr4 (PSE and PGE, clears PAE)
  */
 extern void setPageSize();
 
@@ -43,11 +75,109 @@ extern void setPageSize();
 extern void enablePaging();
 
 /* initPaging
- * inputs: unsigned long * - pointer to page directory
+ * inputs: none
  * outputs: none
  * return value: none
- * side effects: inits a page dir, loads it, enables paging
+ * side effects: inits the kernel page dir, loads it, enables paging
  */
 extern void initPaging();
 
+/* switch_page_directory
+ * inputs: page_directory - directory to run on
+ * outputs: none
+ * return value: none
+ * side effects: loads cr3 unless that directory is already loaded
+ */
+extern void switch_page_directory(uint32_t * page_directory);
+
+/* flush_tlb
+ * inputs: none
+ * outputs: none
+ * return value: none
+ * side effects: flushes every non-global TLB entry
+ */
+extern void flush_tlb();
+
+/* print_paging_stats
+ * inputs: none
+ * outputs: prints the paging counters
+ * return value: none
+ * side effects: none
+ */
+extern void print_paging_stats();
+
+/* create_page_directory
+ * inputs: none
+ * outputs: none
+ * return value: new page directory with only kernel mappings, NULL if out of memory
+ * side effects: allocates a frame
+ */
+extern uint32_t * create_page_directory();
+
+/* destroy_page_directory
+ * inputs: page_directory - directory from create_page_directory, must not be loaded
+ * outputs: none
+ * return value: none
+ * side effects: frees the directory, its page tables and every PAGE_OWNED frame
+ */
+extern void destroy_page_directory(uint32_t * page_directory);
+
+/* clone_page_directory
+ * inputs: page_directory - the loaded directory to copy
+ * outputs: none
+ * return value: new directory sharing every user frame copy-on-write, NULL if out of memory
+ * side effects: write protects the parent's pages and flushes the TLB
+ */
+extern uint32_t * clone_page_directory(uint32_t * page_directory);
+
+/* unmap_page_table
+ * inputs: page_directory - directory to unmap from, vaddr - user address in the 4MB region
+ * outputs: none
+ * return value: none
+ * side effects: drops every page in the region and frees its page table, does not flush the TLB
+ */
+extern void unmap_page_table(uint32_t * page_directory, uint32_t vaddr);
+
+/* get_page_table
+ * inputs: page_directory - directory to look in, vaddr - user virtual address,
+ *         create - whether to allocate the page table if it is missing
+ * outputs: none
+ * return value: page table covering vaddr, NULL if missing or out of memory
+ * side effects: may allocate a frame
+ */
+extern uint32_t * get_page_table(uint32_t * page_directory, uint32_t vaddr, int32_t create);
+
+/* map_page
+ * inputs: page_directory - directory to map in, vaddr - user virtual address,
+ *         paddr - physical frame, flags - PTE flags
+ * outputs: none
+ * return value: 0 on success, -1 if a page table could not be allocated
+ * side effects: modifies the page tables, does not flush the TLB
+ */
+extern int32_t map_page(uint32_t * page_directory, uint32_t vaddr, uint32_t paddr, uint32_t flags);
+
+/* copy_on_write
+ * inputs: page_directory - the loaded directory, vaddr - user address that took a write fault
+ * outputs: none
+ * return value: 0 if the page now has a private writable copy, -1 if it is not a COW page or out of memory
+ * side effects: allocates a frame, modifies the page table
+ */
+extern int32_t copy_on_write(uint32_t * page_directory, uint32_t vaddr);
+
+/* kmap
+ * inputs: frame - physical address of a 4KB frame
+ * outputs: none
+ * return value: kernel virtual address of the frame, valid until kunmap
+ * side effects: uses the single KMAP_VADDR slot, interrupts must stay off until kunmap
+ */
+extern void * kmap(uint32_t frame);
+
+/* kunmap
+ * inputs: none
+ * outputs: none
+ * return value: none
+ * side effects: clears the KMAP_VADDR slot
+ */
+extern void kunmap();
+
 #endif
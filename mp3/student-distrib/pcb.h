@@ -3,9 +3,21 @@
 
 #include "types.h"
 #include "terminal.h"
+#include "wait_queue.h"
 
 #define PCB_MASK 0x1FFF
-#define NUM_MAX_OPEN_FILES 8
+// descriptor tables start with room for NUM_INITIAL_OPEN_FILES and double up to
+// NUM_MAX_OPEN_FILES, which must be a multiple of 32
+#define NUM_INITIAL_OPEN_FILES 8
+#define NUM_MAX_OPEN_FILES 256
+#define NUM_MAX_MAPPED_FILES 4
+
+// process states tracked by the scheduler
+#define TASK_UNUSED  0   // slot has never held a process
+#define TASK_RUNNING 1   // currently on the CPU
+#define TASK_READY   2   // sitting in the run queue
+#define TASK_BLOCKED 3   // waiting on something (child process, device), not in the run queue
+#define TASK_ZOMBIE  4   // has halted, slot is being torn down
 
 // file struct
 typedef struct file_t{
@@ -13,11 +25,33 @@ typedef struct file_t{
 	int32_t inode_num;
 	int32_t file_position; // offset
 	int32_t flags;
+	int32_t refcount;  // descriptors pointing at this open file, fork shares them between processes
 } file_t;
 
+// a process's descriptor table
+typedef struct fd_table_t{
+	file_t ** files;                              // size entries, NULL where the descriptor is free
+	uint32_t size;                                // descriptors the table has room for right now
+	uint32_t open_map[NUM_MAX_OPEN_FILES / 32];   // a set bit means the descriptor is in use
+} fd_table_t;
+
+// executable a process was started from, its pages are read in as they are touched
+typedef struct program_image_t{
+	uint32_t inode;
+	uint32_t size;     // file length in bytes
+	uint32_t entry;    // ELF entry point
+} program_image_t;
+
+// a file mapped read-only by mmap, each one gets its own 4MB area above MMAP_BASE
+typedef struct mapped_file_t{
+	uint32_t inode;
+	uint32_t size;     // file length in bytes when it was mapped
+	uint8_t used;
+} mapped_file_t;
+
 // struct for pcb in 4-8MB kernel page
 typedef struct pcb_t {
-	file_t file_array[NUM_MAX_OPEN_FILES];										// An array of file structs for each process
+	fd_table_t fd_table;																			// Open files of this process from the file cache
 	uint32_t parent_num;                                      // 1-indexed PID of parent task, 0 if current task is root shell
 	uint32_t parent_esp;																			// Value to set ESP to on calling halt (ESP of parent process)
 	uint32_t current_esp;                                     // Value to set ESP to on switching to the task (stored in PIT interrupt, restored in later PIT interrupt)
@@ -29,7 +63,20 @@ typedef struct pcb_t {
 	uint8_t arg[TERMINAL_BUFFER_SIZE];												// Buffer containing the arguments to the process
 	uint8_t num_char_in_arg;																	// Number of characters in argument buffer
 	uint8_t terminal_index;                                   // What terminal this process is running on
+	uint8_t forked;																						// Created by fork, so halt has no parent blocked in execute to return to
 	uint8_t is_user_mode;																			// Whether a PIT interrupt should return to user mode or kernel mode (useful for launching 2nd and 3rd terminal shells)
+	uint8_t state;																						// One of the TASK_* states above
+	uint8_t priority;																					// Run queue level, 0 is the highest priority
+	uint32_t next_ready;																			// 1-indexed PID of the next task in the same run queue level, 0 if last
+	uint32_t prev_ready;																			// 1-indexed PID of the previous task in the same run queue level, 0 if first
+	uint32_t next_waiting;																		// 1-indexed PID of the next task on the same wait queue, 0 if last
+	wait_queue_t rtc_wait;																		// Where rtc_read sleeps until rtc_count reaches 0
+	uint32_t * page_directory;																// This process's address space, allocated in execute
+	program_image_t image;																		// Executable mapped at V_PROGRAM_BASE
+	uint8_t * kernel_stack;																		// Base of this process's 8KB kernel stack, its first word points back here
+	uint32_t * video_page_table;															// Page table behind the vidmap page at 256MB, NULL until vidmap is called
+	uint32_t next_video_mapper;																// 1-indexed PID of the next process with its terminal's screen vidmapped, 0 if last
+	mapped_file_t mapped_files[NUM_MAX_MAPPED_FILES];					// Files mapped by mmap, slot i is at MMAP_BASE + i * 4MB
 } pcb_t;
 
 
@@ -0,0 +1,189 @@
+#include "syscalls.h"
+#include "process.h"
+#include "page_alloc.h"
+#include "slab.h"
+
+// the boot stack (which the idle task keeps using) sits right under the 8MB mark
+#define BOOT_STACK_TOP 0x800000
+// kernel stacks are two 4KB frames, naturally aligned so the PCB can be found by masking ESP
+#define KERNEL_STACK_ORDER 1
+
+// bit (pid - 1) is set while pid is in use, bits past NUM_MAX_PROCESSES in the last word stay set
+static uint32_t pid_bitmap[PID_BITMAP_WORDS];
+
+// PCB of every live process indexed by PID, entry 0 is the idle task
+static pcb_t * process_table[NUM_MAX_PROCESSES + 1];
+
+// PCBs come from their own slab cache, the kernel stack only keeps a pointer to its PCB
+kmem_cache_t pcb_cache;
+
+/*
+ * process_init
+ *   DESCRIPTION: clears the PID bitmap, sets up the PCB cache and gives the
+ *                idle task (which keeps the boot stack) its PCB
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: sets up process_table, pid_bitmap and pcb_cache
+ */
+void process_init(void){
+  uint32_t i;
+  pcb_t * idle;
+
+  for (i = 0; i < PID_BITMAP_WORDS; i++)
+    pid_bitmap[i] = 0;
+  // PIDs past NUM_MAX_PROCESSES have no process_table slot, so they are never free
+  for (i = NUM_MAX_PROCESSES; i < PID_BITMAP_WORDS * 32; i++)
+    pid_bitmap[i / 32] |= (1 << (i % 32));
+  for (i = 0; i <= NUM_MAX_PROCESSES; i++)
+    process_table[i] = NULL;
+
+  kmem_cache_init(&pcb_cache, "pcb", sizeof(pcb_t));
+
+  // The boot stack becomes the idle task's stack
+  idle = (pcb_t *) kmem_cache_alloc(&pcb_cache);
+  memset(idle, 0, sizeof(pcb_t));
+  idle->kernel_stack = (uint8_t *)(BOOT_STACK_TOP - KERNEL_STACK_SIZE);
+  *(pcb_t **) idle->kernel_stack = idle;
+  process_table[0] = idle;
+}
+
+/*
+ * alloc_pid
+ *   DESCRIPTION: finds the lowest free PID through the bitmap and allocates a
+ *                kernel stack and a zeroed PCB for it. PIDs never go past
+ *                NUM_MAX_PROCESSES, the size of every per-PID table
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new 1-indexed PID, -1 if the table or memory is full
+ *   SIDE EFFECTS: modifies pid_bitmap, process_table and the frame allocator
+ */
+int32_t alloc_pid(void){
+  uint32_t word, bit, pid, flags, stack;
+  pcb_t * pcb;
+
+  cli_and_save(flags);
+  for (word = 0; word < PID_BITMAP_WORDS; word++){
+    if (pid_bitmap[word] != 0xFFFFFFFF)
+      break;
+  }
+  if (word == PID_BITMAP_WORDS){
+    restore_flags(flags);
+    return -1;
+  }
+  bit = find_first_set(~pid_bitmap[word]);
+  pid = word * 32 + bit + 1;
+  if (pid > NUM_MAX_PROCESSES){
+    restore_flags(flags);
+    return -1;
+  }
+
+  stack = alloc_pages(ALLOC_KERNEL, KERNEL_STACK_ORDER);
+  if (stack == 0){
+    restore_flags(flags);
+    return -1;
+  }
+  pcb = (pcb_t *) kmem_cache_alloc(&pcb_cache);
+  if (pcb == NULL){
+    free_pages(stack, KERNEL_STACK_ORDER);
+    restore_flags(flags);
+    return -1;
+  }
+
+  // the first word of the stack points back at the PCB for getCurrentProcessPCB
+  memset(pcb, 0, sizeof(pcb_t));
+  pcb->kernel_stack = (uint8_t *) stack;
+  *(pcb_t **) stack = pcb;
+
+  pid_bitmap[word] |= (1 << bit);
+  process_table[pid] = pcb;
+
+  restore_flags(flags);
+  return pid;
+}
+
+/*
+ * free_pid
+ *   DESCRIPTION: releases a PID, its PCB, any files it still has open and its
+ *                kernel stack. Safe to call while still
+ *                running on that stack as long as interrupts stay off until the
+ *                switch away from it
+ *   INPUTS: pid - the 1-indexed PID to release
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies pid_bitmap, process_table and the frame allocator
+ */
+void free_pid(uint32_t pid){
+  uint32_t flags;
+
+  if (!pid_is_active(pid))
+    return;
+
+  cli_and_save(flags);
+  release_fd_table(&process_table[pid]->fd_table);
+  free_pages((uint32_t) process_table[pid]->kernel_stack, KERNEL_STACK_ORDER);
+  kmem_cache_free(&pcb_cache, process_table[pid]);
+  process_table[pid] = NULL;
+  pid_bitmap[(pid - 1) / 32] &= ~(1 << ((pid - 1) % 32));
+  restore_flags(flags);
+}
+
+/*
+ * pid_is_active
+ *   DESCRIPTION: checks whether a PID is in use
+ *   INPUTS: pid - 1-indexed PID
+ *   OUTPUTS: none
+ *   RETURN VALUE: nonzero if the PID belongs to a live process
+ *   SIDE EFFECTS: none
+ */
+uint32_t pid_is_active(uint32_t pid){
+  if (pid == 0 || pid > NUM_MAX_PROCESSES)
+    return 0;
+  return pid_bitmap[(pid - 1) / 32] & (1 << ((pid - 1) % 32));
+}
+
+/*
+ * next_active_pid
+ *   DESCRIPTION: walks the live PIDs in order, skipping 32 free ones at a time
+ *   INPUTS: pid - the PID to start after, 0 to start from the beginning
+ *   OUTPUTS: none
+ *   RETURN VALUE: the next live PID greater than pid, 0 if there is none
+ *   SIDE EFFECTS: none
+ */
+uint32_t next_active_pid(uint32_t pid){
+  uint32_t word, bits;
+
+  // PID p is bit p - 1, so the PID after pid is bit number pid
+  for (word = pid / 32; word < PID_BITMAP_WORDS; word++){
+    bits = pid_bitmap[word];
+    if (word == pid / 32)
+      bits &= ~0U << (pid % 32);
+    if (bits != 0){
+      pid = word * 32 + find_first_set(bits) + 1;
+      return (pid <= NUM_MAX_PROCESSES) ? pid : 0;   // the bits past the last PID are always set
+    }
+  }
+  return 0;
+}
+
+/*
+ * pcb_t * getCurrentProcessPCB()
+ *   DESCRIPTION: returns pointer to the current PCB
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: A pointer to the active PCB
+ *   SIDE EFFECTS: none
+ */
+pcb_t * getCurrentProcessPCB(){
+  uint32_t esp;
+  asm volatile ("\t movl %%esp,%0" : "=r"(esp));
+  return *(pcb_t **)(esp & ~(PCB_MASK));
+}
+
+pcb_t * getProcessPCB(uint32_t pid){
+  return process_table[pid];
+}
+
+uint32_t get_kernel_stack_bottom(uint32_t pid){
+  return (uint32_t) process_table[pid]->kernel_stack + KERNEL_STACK_SIZE - B_4;
+}
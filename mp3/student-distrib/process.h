@@ -0,0 +1,41 @@
+#ifndef PROCESS_H_
+#define PROCESS_H_
+
+#include "types.h"
+#include "pcb.h"
+#include "paging.h"
+#include "slab.h"
+
+// size of each process's kernel stack, its lowest word points at the process's PCB
+#define KERNEL_STACK_SIZE 0x2000
+// number of 32-bit words in the PID bitmap
+#define PID_BITMAP_WORDS ((NUM_MAX_PROCESSES + 31) / 32)
+
+// slab cache the PCBs are allocated from
+extern kmem_cache_t pcb_cache;
+
+/* Sets up the PID bitmap, the PCB cache and the idle task's PCB */
+void process_init(void);
+
+/* Reserves the lowest free PID and gives it a kernel stack and a zeroed PCB */
+int32_t alloc_pid(void);
+
+/* Returns a PID, its PCB and its kernel stack */
+void free_pid(uint32_t pid);
+
+/* Whether a PID currently belongs to a live process */
+uint32_t pid_is_active(uint32_t pid);
+
+/* Next live PID after pid (pass 0 to get the first one), 0 when there are no more */
+uint32_t next_active_pid(uint32_t pid);
+
+//Helper function to get current PCB
+pcb_t * getCurrentProcessPCB();
+
+//Helper function to get PCB associated with any process
+pcb_t * getProcessPCB(uint32_t pid);
+
+//Helper function to get the address of the bottom of any process' kernel stack
+uint32_t get_kernel_stack_bottom(uint32_t pid);
+
+#endif
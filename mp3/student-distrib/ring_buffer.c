@@ -0,0 +1,93 @@
+#include "ring_buffer.h"
+
+// keeps the compiler from moving data accesses across an update of head or tail,
+// x86 doesn't reorder the stores themselves
+#define ring_barrier() asm volatile("" : : : "memory")
+
+/*
+ * ring_init
+ *   DESCRIPTION: empties a ring
+ *   INPUTS: ring - the ring to initialize
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the ring
+ */
+void ring_init(ring_buffer_t *ring){
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+/*
+ * ring_count
+ *   DESCRIPTION: finds how many bytes are waiting in a ring
+ *   INPUTS: ring - the ring
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes
+ *   SIDE EFFECTS: none
+ */
+uint32_t ring_count(const ring_buffer_t *ring){
+    return ring->head - ring->tail;
+}
+
+/*
+ * ring_space
+ *   DESCRIPTION: finds how many more bytes a ring can take
+ *   INPUTS: ring - the ring
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes
+ *   SIDE EFFECTS: none
+ */
+uint32_t ring_space(const ring_buffer_t *ring){
+    return RING_BUFFER_SIZE - ring_count(ring);
+}
+
+/*
+ * ring_put
+ *   DESCRIPTION: adds bytes to a ring. The bytes are stored before head moves,
+ *                so the consumer never sees a byte that isn't there yet
+ *   INPUTS: ring - the ring; buf - bytes to add; count - how many
+ *   OUTPUTS: none
+ *   RETURN VALUE: number of bytes added, fewer than count if the ring filled up
+ *   SIDE EFFECTS: advances head
+ */
+uint32_t ring_put(ring_buffer_t *ring, const uint8_t *buf, uint32_t count){
+    uint32_t head = ring->head;
+    uint32_t i;
+
+    if(count > RING_BUFFER_SIZE - (head - ring->tail))
+        count = RING_BUFFER_SIZE - (head - ring->tail);
+    for(i = 0; i < count; i++)
+        ring->data[(head + i) & (RING_BUFFER_SIZE - 1)] = buf[i];
+    ring_barrier();
+    ring->head = head + count;
+    return count;
+}
+
+/*
+ * ring_get
+ *   DESCRIPTION: takes bytes out of a ring, stopping after count bytes or
+ *                after the stop byte, whichever comes first. Only the bytes
+ *                returned are touched, nothing is shifted
+ *   INPUTS: ring - the ring; buf - where to copy the bytes; count - most bytes to take
+ *           stop - byte that ends the copy (and is copied), -1 for none
+ *   OUTPUTS: the bytes in buf
+ *   RETURN VALUE: number of bytes taken
+ *   SIDE EFFECTS: advances tail
+ */
+uint32_t ring_get(ring_buffer_t *ring, uint8_t *buf, uint32_t count, int32_t stop){
+    uint32_t tail = ring->tail;
+    uint32_t available = ring->head - tail;
+    uint32_t i;
+
+    ring_barrier();
+    if(count > available)
+        count = available;
+    for(i = 0; i < count; ){
+        buf[i] = ring->data[(tail + i) & (RING_BUFFER_SIZE - 1)];
+        if(buf[i++] == stop)
+            break;
+    }
+    ring_barrier();
+    ring->tail = tail + i;
+    return i;
+}
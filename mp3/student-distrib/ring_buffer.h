@@ -0,0 +1,37 @@
+#ifndef RING_BUFFER_H_
+#define RING_BUFFER_H_
+
+#include "types.h"
+
+// bytes in a ring, a power of 2
+#define RING_BUFFER_SIZE 512
+
+/*
+ * A single producer, single consumer ring of bytes. The producer only moves
+ * head and the consumer only moves tail, so neither ever locks the other out:
+ * an interrupt handler can add bytes while a process is taking them out.
+ * head and tail count bytes forever and wrap through the mask, so head - tail
+ * is always the number of bytes waiting, even across the 32 bit wrap.
+ */
+typedef struct ring_buffer_t {
+    volatile uint32_t head;         // bytes ever put in, only the producer changes it
+    volatile uint32_t tail;         // bytes ever taken out, only the consumer changes it
+    uint8_t data[RING_BUFFER_SIZE];
+} ring_buffer_t;
+
+/* This method empties a ring */
+void ring_init(ring_buffer_t *ring);
+
+/* This method gives the number of bytes waiting in a ring */
+uint32_t ring_count(const ring_buffer_t *ring);
+
+/* This method gives the number of bytes that can still be put in a ring */
+uint32_t ring_space(const ring_buffer_t *ring);
+
+/* This method adds bytes to a ring, only the producer may call it */
+uint32_t ring_put(ring_buffer_t *ring, const uint8_t *buf, uint32_t count);
+
+/* This method takes bytes out of a ring up to a stop byte, only the consumer may call it */
+uint32_t ring_get(ring_buffer_t *ring, uint8_t *buf, uint32_t count, int32_t stop);
+
+#endif
@@ -42,9 +42,9 @@ void rtc_init(){
  *   RETURN VALUE: always returns 0
  */
 int32_t rtc_open(int32_t fd){
-		pcb_t * pcb = getCurrentProcessPCB();
-		pcb->file_array[fd].file_position = 2;    //Default interrupt rate is 2 hertz
-		pcb->file_array[fd].flags = FILE_OCCUP;
+		file_t * file = get_file(fd);
+		file->file_position = 2;    //Default interrupt rate is 2 hertz
+		file->flags = FILE_OCCUP;
 
 		return 0;
 }
@@ -54,21 +54,11 @@ int32_t rtc_open(int32_t fd){
  *   DESCRIPTION: Closes RTC and resets the FD
  * 	 INTPUT: int32_t fd: The filedescriptor to close
  * 	 OUTPUT: none
- *   SIDE EFFECTS: Modifies PCB/file descriptor and sets a file as closed
+ *   SIDE EFFECTS: Frees the file and marks the descriptor as free
  *   RETURN VALUE: -1 if file isn't open, 0 if successful
  */
 int32_t rtc_close(int32_t fd){
-	pcb_t * pcb = getCurrentProcessPCB();
-
-	if(pcb->file_array[fd].flags == FILE_AVAIL)
-			return -1;
-
-	pcb->file_array[fd].file_position = 0;
-	pcb->file_array[fd].file_ops_table_ptr = 0;
-	pcb->file_array[fd].inode_num = 0;
-	pcb->file_array[fd].flags = FILE_AVAIL;
-
-	return 0;
+	return file_close(fd);
 }
 
 /*
@@ -79,11 +69,15 @@ int32_t rtc_close(int32_t fd){
  * 		OUTPUT: Returns 0
  */
 int32_t rtc_read(int32_t fd, void* buf, int32_t nbytes){
+	uint32_t flags;
 	pcb_t* pcb = getCurrentProcessPCB();
-	pcb->rtc_count = 1024 / (pcb->file_array[fd].file_position);
-	while(pcb->rtc_count != 0)	/* Waits until interrupt counter % calculated value == 0, then returns 0*/
+	cli_and_save(flags);
+	pcb->rtc_count = RTC_FREQ / (get_file(fd)->file_position);
+	while(pcb->rtc_count != 0)	/* Sleeps until rtc_int counts rtc_count down to 0, then returns 0*/
 	{
+		sleep_on(&pcb->rtc_wait);
 	}
+	restore_flags(flags);
 	return 0;
 }
 
@@ -99,33 +93,74 @@ int32_t rtc_write(int32_t fd, const void* buf, int32_t nbytes){
 		{
 			return -1;
 		}
-	/*If valid, writes the frequency into the current pcb_t's frequency field */
+	/*If valid, writes the frequency into the open RTC file's frequency field */
 	int freq;
-	pcb_t* pcb = getCurrentProcessPCB();
 	freq = *(int32_t*) buf;
 	if(freq < 2 || freq > 1024 || (freq & (freq - 1)))  //Check if valid requested frequency
 			return -1;
 
-	pcb->file_array[fd].file_position = freq;
+	get_file(fd)->file_position = freq;
 	return 4;
 }
 
+/*
+ * uint32_t rtc_next_deadline()
+ *   DESCRIPTION: Finds how soon the next rtc_read will be done, used by the idle task
+ *                to arm a one-shot PIT instead of taking every RTC interrupt
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: smallest nonzero rtc_count of any process, 0 if no process is waiting
+ *   SIDE EFFECTS: none
+ */
+uint32_t rtc_next_deadline(void){
+		uint32_t pid;
+		uint32_t deadline = 0;
+		for(pid = next_active_pid(0); pid != 0; pid = next_active_pid(pid)){
+				pcb_t * pcb = getProcessPCB(pid);
+				if(pcb->rtc_count != 0 && (deadline == 0 || pcb->rtc_count < deadline))
+						deadline = pcb->rtc_count;
+		}
+		return deadline;
+}
+
+/*
+ * void rtc_advance(uint32_t ticks)
+ *   DESCRIPTION: Counts every pending rtc_read down by a number of 1024Hz ticks
+ *   INPUTS: ticks - how many RTC periods have passed
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies PCB by changing rtc_count, wakes processes whose rtc_read is done
+ */
+void rtc_advance(uint32_t ticks){
+		uint32_t pid, flags;
+		if(ticks == 0) return;
+		cli_and_save(flags);
+		for(pid = next_active_pid(0); pid != 0; pid = next_active_pid(pid)){
+				pcb_t * pcb = getProcessPCB(pid);   //Iterate through all live PCBs to update the RTC count
+				if(pcb->rtc_count == 0) continue;
+				if(pcb->rtc_count <= ticks){
+						pcb->rtc_count = 0;
+						wake_up(&pcb->rtc_wait);      //Virtual tick finished, let the reader run again
+				}
+				else
+						pcb->rtc_count -= ticks;
+		}
+		restore_flags(flags);
+}
+
 /*
  * void rtc_int()
  *   DESCRIPTION: Called when an RTC interrupt occurs
  *   INPUTS: none
  *   OUTPUTS: none
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Allows for an RTC interrupt to return, modifies PCB by changing rtc_count
+ *   SIDE EFFECTS: Allows for an RTC interrupt to return, modifies PCB by changing rtc_count,
+ *                 wakes processes whose rtc_read is done
  */
 void rtc_int(){
-		uint8_t i;
 		uint32_t flags;
 		cli_and_save(flags);
-		for(i = 0; i < NUM_MAX_PROCESSES; i++){
-				pcb_t * pcb = getProcessPCB(i + 1);   //Iterate through all PCBs to update the RTC count
-				if(pcb->rtc_count != 0) (pcb->rtc_count)--;
-		}
+		rtc_advance(1);
 
 		//This code reads from the rtc to allow next interrupt
 		outb(0x0C, 0x70);
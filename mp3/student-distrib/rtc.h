@@ -15,6 +15,13 @@ int32_t set_freq(int32_t freq);
 
 void rtc_int();
 
+/* Ticks until the earliest pending rtc_read finishes, 0 if nobody is waiting */
+uint32_t rtc_next_deadline(void);
+/* Counts down every pending rtc_read by a number of 1024Hz ticks */
+void rtc_advance(uint32_t ticks);
+
+#define RTC_FREQ 1024	/* Rate the RTC is programmed to in rtc_init */
+
 #define RTC_PORT 0x70	/* Address of RTC PORT */
 #define DATA_PORT 0x71	/* Address of RTC's DATA PORT */
 #endif
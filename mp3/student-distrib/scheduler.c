@@ -1,55 +1,222 @@
 #include "scheduler.h"
 
-static uint32_t terminal_iter = 0;
-
 #define PIT_IRQ_PORT 0x40
 #define PIT_CMD_PORT 0x43
 #define PIT_INT_MODE 0x36
+#define PIT_ONESHOT_MODE 0x30   // channel 0, lobyte/hibyte, mode 0 (interrupt on terminal count)
+#define PIT_LATCH_CMD 0x00      // latch channel 0's count so it can be read
+#define PIT_FREQ 1193180
+#define PIT_MAX_COUNT 0xFFFF
+#define TICK_HZ 100
+
+// head and tail PIDs of a single priority level, 0 when the level is empty
+typedef struct run_queue_t {
+  uint32_t head;
+  uint32_t tail;
+} run_queue_t;
+
+static run_queue_t run_queue[NUM_PRIORITY_LEVELS];
+
+// bit i is set when run_queue[i] has at least one task in it
+static uint32_t ready_bitmap = 0;
+
+// set while the idle task has the periodic tick switched off
+static uint8_t tick_stopped = 0;
+// set by the PIT interrupt if the idle one-shot ran out before something else woke us
+static volatile uint8_t oneshot_expired = 0;
+// count the one-shot was armed with
+static uint16_t oneshot_count;
+// PIT counts * RTC_FREQ not yet turned into a whole RTC tick
+static uint32_t pit_remainder = 0;
+
+// number of times schedule() handed the CPU to a different task
+uint32_t context_switches = 0;
+
+// a forked task that halted, its PCB and kernel stack are freed once the CPU is off that stack
+static uint32_t zombie_pid = 0;
+
+/* reap_zombie
+ * DESCRIPTION: frees the PID, PCB and kernel stack of the last forked task to halt,
+ *              unless we are still running on its stack
+ * INPUTS: none
+ * OUTPUTS: none
+ * RETURN VALUE: none
+ * SIDE EFFECTS: may free a PCB and kernel stack
+ */
+static void reap_zombie(void)
+{
+  if (zombie_pid != 0 && zombie_pid != curr_process)
+  {
+    free_pid(zombie_pid);
+    zombie_pid = 0;
+  }
+}
+
+/* find_first_level
+ * DESCRIPTION: finds the highest priority level that has a ready task
+ * INPUTS: none
+ * OUTPUTS: none
+ * RETURN VALUE: index of the lowest set bit in ready_bitmap, -1 if it is empty
+ * SIDE EFFECTS: none
+ */
+static inline int32_t find_first_level(void)
+{
+  if (ready_bitmap == 0)
+    return -1;
+  return (int32_t) find_first_set(ready_bitmap);
+}
+
+/* enqueue_task
+ * DESCRIPTION: appends a task to the tail of its priority level and marks it ready
+ * INPUTS: pid - 1-indexed PID of the task
+ * OUTPUTS: none
+ * RETURN VALUE: none
+ * SIDE EFFECTS: modifies run_queue, ready_bitmap and the task's PCB
+ */
+void enqueue_task(uint32_t pid)
+{
+  pcb_t *pcb = getProcessPCB(pid);
+  run_queue_t *queue = &run_queue[pcb->priority];
+
+  pcb->state = TASK_READY;
+  pcb->next_ready = 0;
+  pcb->prev_ready = queue->tail;
+
+  if (queue->tail == 0)
+    queue->head = pid;
+  else
+    getProcessPCB(queue->tail)->next_ready = pid;
+  queue->tail = pid;
+
+  ready_bitmap |= (1 << pcb->priority);
+}
+
+/* dequeue_task
+ * DESCRIPTION: unlinks a task from its priority level in O(1)
+ * INPUTS: pid - 1-indexed PID of the task, must currently be ready
+ * OUTPUTS: none
+ * RETURN VALUE: none
+ * SIDE EFFECTS: modifies run_queue and ready_bitmap, does not change the task's state
+ */
+void dequeue_task(uint32_t pid)
+{
+  pcb_t *pcb = getProcessPCB(pid);
+  run_queue_t *queue = &run_queue[pcb->priority];
+
+  if (pcb->prev_ready == 0)
+    queue->head = pcb->next_ready;
+  else
+    getProcessPCB(pcb->prev_ready)->next_ready = pcb->next_ready;
+
+  if (pcb->next_ready == 0)
+    queue->tail = pcb->prev_ready;
+  else
+    getProcessPCB(pcb->next_ready)->prev_ready = pcb->prev_ready;
+
+  pcb->next_ready = 0;
+  pcb->prev_ready = 0;
+
+  if (queue->head == 0)
+    ready_bitmap &= ~(1 << pcb->priority);
+}
 
 /* schedule
- * DESCRIPTION: implements round robin scheduling among running processes
+ * DESCRIPTION: picks the highest priority ready task and switches to it,
+ *              round robin among tasks of the same priority. Called from the PIT
+ *              handler, and through yield() when a process blocks
  * INPUTS: none
  * OUTPUTS: none
  * RETURN VALUE: none
- * SIDE EFFECTS: modifies values in PCB, changes page directory
+ * SIDE EFFECTS: modifies values in PCB and the run queue, changes page directory
  */
 void schedule(void)
 {
   // Save esp/ebp - save current process esp and ebp in PCB
   uint32_t next_ebp, next_esp, next_eip;
-  int32_t pid;
+  int32_t pid, level;
   pcb_t *my_pcb = getCurrentProcessPCB();
   pcb_t *next_pcb;
-  asm volatile("movl %%ebp, %0" : "=r" (my_pcb->current_ebp));
-  asm volatile("movl %%esp, %0" : "=r" (my_pcb->current_esp));
 
-  my_pcb->current_eip = (uint32_t) &&EIP_RETURN;
-  my_pcb->is_user_mode = 0;
+  // The only way to get here with the tick stopped is the idle one-shot firing
+  if (tick_stopped)
+    oneshot_expired = 1;
+
+  reap_zombie();
+
+  if (my_pcb->state == TASK_ZOMBIE)
+  {
+    // Halting for good, so there is no context to save. The PCB and this
+    // stack are freed by whoever runs next, once we are off the stack
+    zombie_pid = curr_process;
+  }
+  else
+  {
+    asm volatile("movl %%ebp, %0" : "=r" (my_pcb->current_ebp));
+    asm volatile("movl %%esp, %0" : "=r" (my_pcb->current_esp));
+
+    my_pcb->current_eip = (uint32_t) &&EIP_RETURN;
+    my_pcb->is_user_mode = 0;
+  }
 
-  // Switch process paging
-  terminal_iter = (terminal_iter + 1) % NUM_TERMINALS;
+  level = find_first_level();
+  if (curr_process == IDLE_PID)
+  {
+    // Idle never sits in the run queue, it just waits for somebody else
+    if (level == -1)
+      return;
+  }
+  else if (my_pcb->state == TASK_RUNNING)
+  {
+    // Keep running if nothing of equal or higher priority is waiting
+    if (level == -1 || level > my_pcb->priority)
+      return;
 
-  pid = (int32_t) terminals[terminal_iter].active_process;
-  while (pid == -1)
+    // Otherwise go to the back of our own level
+    enqueue_task(curr_process);
+    level = find_first_level();
+  }
+
+  if (level == -1)
   {
-    terminal_iter = (terminal_iter + 1) % NUM_TERMINALS;
-    pid = terminals[terminal_iter].active_process;
+    // We blocked and nobody is ready, fall back to the idle task
+    pid = IDLE_PID;
+    next_pcb = getProcessPCB(IDLE_PID);
   }
+  else
+  {
+    // Take the task at the head of the best level
+    pid = (int32_t) run_queue[level].head;
+    dequeue_task(pid);
+    next_pcb = getProcessPCB( (uint32_t) pid);
+    next_pcb->state = TASK_RUNNING;
+  }
+
+  if (pid == curr_process)
+    return;
 
-  loadPageDirectory(page_directory_array[pid - 1]);
+  // Idle only runs kernel code, so it keeps whatever page directory is loaded
+  if (pid != IDLE_PID)
+  {
+    // Switch process paging
+    switch_page_directory(getProcessPCB(pid)->page_directory);
+
+    // Set TSS
+    tss.esp0 = get_kernel_stack_bottom(pid);
+  }
 
-  // Set TSS
-  tss.esp0 = get_kernel_stack_bottom(pid);
+  context_switches++;
 
   // Restore next process’ esp/ebp
-  next_pcb = getProcessPCB( (uint32_t) pid);
   next_ebp = next_pcb->current_ebp;
   next_esp = next_pcb->current_esp;
   next_eip = next_pcb->current_eip;
   curr_process = pid;
+
+  // The next task may have given up the CPU through yield() rather than the PIT
+  // handler, so it would never acknowledge this tick - do it now
+  send_eoi(0);
   if(next_pcb->is_user_mode)
   {
-      send_eoi(0);
       context_switch(next_eip, next_esp, next_ebp);
   }
   else
@@ -57,10 +224,122 @@ void schedule(void)
     kernel_context_switch(next_eip, next_esp, next_ebp);
   }
 
-  EIP_RETURN:;
+  EIP_RETURN:
+  reap_zombie();
   return;
 }
 
+/* tick_stop
+ * DESCRIPTION: turns the periodic tick off while idle. The PIT is put in
+ *              one-shot mode and armed for the earliest pending rtc_read
+ *              deadline (or left stopped if there is none), and the RTC itself
+ *              is masked so it stops waking us 1024 times a second
+ * INPUTS: none
+ * OUTPUTS: reprograms the PIT
+ * RETURN VALUE: none
+ * SIDE EFFECTS: masks IRQ 8, sets tick_stopped
+ */
+static void tick_stop(void)
+{
+  uint32_t deadline = rtc_next_deadline();
+  uint32_t count = PIT_MAX_COUNT;
+
+  disable_irq(8);
+  oneshot_expired = 0;
+  tick_stopped = 1;
+
+  // Writing the mode alone stops channel 0 until a count is loaded, so with no
+  // deadline pending nothing but a device interrupt will wake us up
+  outb(PIT_ONESHOT_MODE, PIT_CMD_PORT);
+  if (deadline == 0)
+  {
+    oneshot_count = 0;
+    return;
+  }
+
+  // Round up so we never wake before the deadline, cap at the longest one-shot
+  if (deadline < (PIT_MAX_COUNT * RTC_FREQ) / PIT_FREQ)
+    count = (deadline * PIT_FREQ + RTC_FREQ - 1) / RTC_FREQ;
+
+  oneshot_count = (uint16_t) count;
+  outb(oneshot_count & 0xFF, PIT_IRQ_PORT);
+  outb(oneshot_count >> 8, PIT_IRQ_PORT);
+}
+
+/* tick_restart
+ * DESCRIPTION: leaves one-shot mode after the idle task wakes up, credits the
+ *              time spent halted to pending rtc_reads and restarts the periodic
+ *              tick and the RTC
+ * INPUTS: none
+ * OUTPUTS: reprograms the PIT
+ * RETURN VALUE: none
+ * SIDE EFFECTS: may wake processes sleeping in rtc_read, unmasks IRQ 8
+ */
+static void tick_restart(void)
+{
+  uint32_t elapsed, scaled;
+  uint16_t current;
+
+  if (!tick_stopped)
+    return;
+
+  if (oneshot_count == 0)
+  {
+    // Nothing was waiting on the clock, so there is no time to account for
+    elapsed = 0;
+  }
+  else if (oneshot_expired)
+  {
+    elapsed = oneshot_count;
+  }
+  else
+  {
+    // Woken early by another interrupt, see how far the count got
+    outb(PIT_LATCH_CMD, PIT_CMD_PORT);
+    current = inb(PIT_IRQ_PORT);
+    current |= inb(PIT_IRQ_PORT) << 8;
+    elapsed = (current <= oneshot_count) ? oneshot_count - current : oneshot_count;
+  }
+
+  scaled = elapsed * RTC_FREQ + pit_remainder;
+  pit_remainder = scaled % PIT_FREQ;
+  rtc_advance(scaled / PIT_FREQ);
+
+  tick_stopped = 0;
+  pit_init();
+  enable_irq(8);
+}
+
+/* idle_task
+ * DESCRIPTION: body of the idle task (PID 0), which is the boot thread once it
+ *              has launched the first shell. Runs whenever every process is
+ *              blocked, halting the CPU with the tick switched off, and hands
+ *              the CPU over as soon as an interrupt makes something ready
+ * INPUTS: none
+ * OUTPUTS: none
+ * RETURN VALUE: never returns
+ * SIDE EFFECTS: reprograms the PIT and RTC interrupt mask
+ */
+void idle_task(void)
+{
+  while (1)
+  {
+    cli();
+    if (find_first_level() == -1)
+    {
+      tick_stop();
+      // sti only takes effect after the next instruction, so no interrupt can
+      // sneak in between it and the hlt
+      asm volatile("sti; hlt" : : : "memory");
+      cli();
+      tick_restart();
+    }
+    if (find_first_level() != -1)
+      yield();
+    sti();
+  }
+}
+
 /* pit_init
  * DESCRIPTION: initializes the PIT
  * INPUTS: none
@@ -72,7 +351,7 @@ void schedule(void)
 void pit_init(void)
 {
     //set the frequency to 100Hz = 1 interrupt every 100ms
-    uint16_t rate = 1193180 / 100;         //values from OSDEV
+    uint16_t rate = PIT_FREQ / TICK_HZ;         //values from OSDEV
     outb(PIT_INT_MODE, PIT_CMD_PORT);
     outb(rate & 0xFF, PIT_IRQ_PORT);
     outb(rate >> 8, PIT_IRQ_PORT);
@@ -10,8 +10,23 @@
 #include "pcb.h" // already included in syscalls.h
 #include "i8259.h"
 
+// number of run queue levels, level 0 is picked first
+#define NUM_PRIORITY_LEVELS 8
+// level new root shells start at, children inherit their parent's level
+#define DEFAULT_PRIORITY 4
+// the boot thread turns into the idle task, it is never in the run queue
+#define IDLE_PID 0
+
+// number of times schedule() handed the CPU to a different task
+extern uint32_t context_switches;
+
 void schedule(void);
 void pit_init(void);
+void idle_task(void);
+
+// Run queue helpers, callers must have interrupts disabled
+void enqueue_task(uint32_t pid);
+void dequeue_task(uint32_t pid);
 
 extern void scheduler_handler(void);
 
@@ -0,0 +1,298 @@
+#include "slab.h"
+#include "page_alloc.h"
+#include "lib.h"
+
+#define SLAB_MAGIC  0x51AB51AB    // page is a slab
+#define LARGE_MAGIC 0x1A26E000    // page is the start of a multi-page kmalloc block
+#define SLAB_MASK (PAGE_SIZE - 1)
+#define OBJECT_ALIGN 16
+
+typedef struct slab_t {
+    uint32_t magic;
+    kmem_cache_t * cache;
+    struct slab_t * next;
+    struct slab_t * prev;
+    void * free_list;               // free objects, linked through their first word
+    uint32_t in_use;                // allocated objects in this slab
+} slab_t;
+
+// header in front of kmalloc blocks too big for a slab, padded so the block stays 16 byte aligned
+typedef struct large_header_t {
+    uint32_t magic;
+    uint32_t order;
+    uint32_t pad[2];
+} large_header_t;
+
+static kmem_cache_t kmalloc_caches[NUM_KMALLOC_CACHES];
+static const char * kmalloc_names[NUM_KMALLOC_CACHES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024"
+};
+static uint32_t large_allocs;       // kmalloc blocks currently held in whole pages
+static uint32_t large_pages;        // pages behind them
+
+static void slab_list_push(slab_t ** list, slab_t * slab){
+    slab->prev = NULL;
+    slab->next = *list;
+    if(*list != NULL)
+        (*list)->prev = slab;
+    *list = slab;
+}
+
+static void slab_list_remove(slab_t ** list, slab_t * slab){
+    if(slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if(slab->next != NULL)
+        slab->next->prev = slab->prev;
+}
+
+/*
+ * kmem_cache_init
+ *   DESCRIPTION: works out the slab layout for a cache, no memory is taken until
+ *                the first allocation
+ *   INPUTS: cache - the cache to set up, name - shown in the stats,
+ *           object_size - bytes per object, at most KMALLOC_MAX_SLAB_SIZE
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the cache
+ */
+void kmem_cache_init(kmem_cache_t * cache, const char * name, uint32_t object_size){
+    if(object_size < sizeof(void *))
+        object_size = sizeof(void *);
+    object_size = (object_size + 3) & ~3;
+
+    cache->name = name;
+    cache->object_size = object_size;
+    cache->first_object = (sizeof(slab_t) + OBJECT_ALIGN - 1) & ~(OBJECT_ALIGN - 1);
+    cache->objects_per_slab = (PAGE_SIZE - cache->first_object) / object_size;
+    cache->partial = NULL;
+    cache->full = NULL;
+    cache->num_slabs = 0;
+    cache->num_active = 0;
+    cache->total_allocs = 0;
+    cache->total_frees = 0;
+    cache->failed_allocs = 0;
+}
+
+/*
+ * cache_grow
+ *   DESCRIPTION: gets a new page for a cache and threads all its objects on the
+ *                slab's free list
+ *   INPUTS: cache - the cache to grow
+ *   OUTPUTS: none
+ *   RETURN VALUE: the new slab, NULL if out of memory
+ *   SIDE EFFECTS: allocates a page, puts the slab on the partial list
+ */
+static slab_t * cache_grow(kmem_cache_t * cache){
+    slab_t * slab = (slab_t *) alloc_pages(ALLOC_KERNEL, 0);
+    uint8_t * object;
+    uint32_t i;
+
+    if(slab == NULL)
+        return NULL;
+
+    slab->magic = SLAB_MAGIC;
+    slab->cache = cache;
+    slab->in_use = 0;
+    slab->free_list = NULL;
+    object = (uint8_t *) slab + cache->first_object + (cache->objects_per_slab - 1) * cache->object_size;
+    for(i = 0; i < cache->objects_per_slab; i++, object -= cache->object_size){
+        *(void **) object = slab->free_list;
+        slab->free_list = object;
+    }
+
+    slab_list_push(&cache->partial, slab);
+    cache->num_slabs++;
+    return slab;
+}
+
+/*
+ * kmem_cache_alloc
+ *   DESCRIPTION: takes a free object from the first partial slab, growing the
+ *                cache if every slab is full
+ *   INPUTS: cache - the cache to allocate from
+ *   OUTPUTS: none
+ *   RETURN VALUE: the object (not zeroed), NULL if out of memory
+ *   SIDE EFFECTS: modifies the cache and its counters
+ */
+void * kmem_cache_alloc(kmem_cache_t * cache){
+    uint32_t flags;
+    slab_t * slab;
+    void * object;
+
+    cli_and_save(flags);
+    slab = cache->partial;
+    if(slab == NULL && (slab = cache_grow(cache)) == NULL){
+        cache->failed_allocs++;
+        restore_flags(flags);
+        return NULL;
+    }
+
+    object = slab->free_list;
+    slab->free_list = *(void **) object;
+    slab->in_use++;
+    if(slab->free_list == NULL){
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+
+    cache->num_active++;
+    cache->total_allocs++;
+    restore_flags(flags);
+    return object;
+}
+
+/*
+ * kmem_cache_free
+ *   DESCRIPTION: puts an object back on its slab's free list. A slab that ends
+ *                up empty is given back to the page allocator unless it is the
+ *                only one with free objects, so a cache that bounces between 0
+ *                and 1 objects does not keep reallocating its page
+ *   INPUTS: cache - the cache the object came from, object - the object
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the cache and its counters
+ */
+void kmem_cache_free(kmem_cache_t * cache, void * object){
+    uint32_t flags;
+    slab_t * slab = (slab_t *) ((uint32_t) object & ~SLAB_MASK);
+
+    if(object == NULL)
+        return;
+
+    cli_and_save(flags);
+    if(slab->free_list == NULL){
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+    *(void **) object = slab->free_list;
+    slab->free_list = object;
+    slab->in_use--;
+    cache->num_active--;
+    cache->total_frees++;
+
+    if(slab->in_use == 0 && (slab->next != NULL || slab->prev != NULL)){
+        slab_list_remove(&cache->partial, slab);
+        slab->magic = 0;
+        free_pages((uint32_t) slab, 0);
+        cache->num_slabs--;
+    }
+    restore_flags(flags);
+}
+
+/*
+ * kmalloc_init
+ *   DESCRIPTION: sets up the power of two size classes behind kmalloc
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies kmalloc_caches
+ */
+void kmalloc_init(void){
+    uint32_t i;
+    for(i = 0; i < NUM_KMALLOC_CACHES; i++)
+        kmem_cache_init(&kmalloc_caches[i], kmalloc_names[i], 1 << (KMALLOC_MIN_SHIFT + i));
+}
+
+/*
+ * kmalloc
+ *   DESCRIPTION: allocates from the smallest size class that fits, or straight
+ *                from the page allocator for anything bigger than a slab object
+ *   INPUTS: size - number of bytes needed
+ *   OUTPUTS: none
+ *   RETURN VALUE: 16 byte aligned memory (not zeroed), NULL if out of memory
+ *   SIDE EFFECTS: modifies the caches or the page allocator
+ */
+void * kmalloc(uint32_t size){
+    uint32_t i, order, flags;
+    large_header_t * header;
+
+    if(size == 0)
+        return NULL;
+
+    if(size <= KMALLOC_MAX_SLAB_SIZE){
+        for(i = 0; (1U << (KMALLOC_MIN_SHIFT + i)) < size; i++);
+        return kmem_cache_alloc(&kmalloc_caches[i]);
+    }
+
+    for(order = 0; (PAGE_SIZE << order) < size + sizeof(large_header_t); order++){
+        if(order == MAX_ORDER)
+            return NULL;
+    }
+    header = (large_header_t *) alloc_pages(ALLOC_KERNEL, order);
+    if(header == NULL)
+        return NULL;
+    header->magic = LARGE_MAGIC;
+    header->order = order;
+
+    cli_and_save(flags);
+    large_allocs++;
+    large_pages += 1 << order;
+    restore_flags(flags);
+    return header + 1;
+}
+
+/*
+ * kfree
+ *   DESCRIPTION: frees kmalloc memory, the header at the start of its page tells
+ *                whether it is a slab object or a multi-page block
+ *   INPUTS: ptr - memory from kmalloc
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the caches or the page allocator
+ */
+void kfree(void * ptr){
+    uint32_t page = (uint32_t) ptr & ~SLAB_MASK;
+    uint32_t order, flags;
+
+    if(ptr == NULL)
+        return;
+
+    if(((slab_t *) page)->magic == SLAB_MAGIC){
+        kmem_cache_free(((slab_t *) page)->cache, ptr);
+    }
+    else if(((large_header_t *) page)->magic == LARGE_MAGIC){
+        order = ((large_header_t *) page)->order;
+        ((large_header_t *) page)->magic = 0;
+        free_pages(page, order);
+
+        cli_and_save(flags);
+        large_allocs--;
+        large_pages -= 1 << order;
+        restore_flags(flags);
+    }
+}
+
+/*
+ * print_cache_stats
+ *   DESCRIPTION: prints one line of counters for a cache
+ *   INPUTS: cache - the cache
+ *   OUTPUTS: prints to the screen
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+static void print_cache_stats(kmem_cache_t * cache){
+    printf("%s: size %d, active %d, slabs %d, allocs %d, frees %d, failed %d\n",
+           cache->name, cache->object_size, cache->num_active, cache->num_slabs,
+           cache->total_allocs, cache->total_frees, cache->failed_allocs);
+}
+
+/*
+ * kmem_print_stats
+ *   DESCRIPTION: prints the allocation counters of the kernel heap
+ *   INPUTS: caches - extra caches to report on, num_caches - how many
+ *   OUTPUTS: prints to the screen
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: none
+ */
+void kmem_print_stats(kmem_cache_t ** caches, uint32_t num_caches){
+    uint32_t i;
+    for(i = 0; i < num_caches; i++)
+        print_cache_stats(caches[i]);
+    for(i = 0; i < NUM_KMALLOC_CACHES; i++)
+        print_cache_stats(&kmalloc_caches[i]);
+    printf("kmalloc-large: active %d, pages %d\n", large_allocs, large_pages);
+    printf("free pages: %d\n", free_page_count());
+}
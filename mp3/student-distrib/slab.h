@@ -0,0 +1,56 @@
+#ifndef SLAB_H_
+#define SLAB_H_
+
+#include "types.h"
+
+// largest request kmalloc serves from a slab, bigger ones get whole pages
+#define KMALLOC_MAX_SLAB_SIZE 1024
+// kmalloc size classes: 16, 32, ..., KMALLOC_MAX_SLAB_SIZE
+#define KMALLOC_MIN_SHIFT 4
+#define NUM_KMALLOC_CACHES 7
+
+struct slab_t;
+
+/*
+ * A cache hands out fixed-size objects carved from 4KB slabs. Slabs with free
+ * objects sit on the partial list, fully used ones on the full list. Every slab
+ * starts with its slab_t header, so an object's slab is found by masking off the
+ * low 12 bits of its address.
+ */
+typedef struct kmem_cache_t {
+    const char * name;
+    uint32_t object_size;           // bytes per object, rounded up to 4
+    uint32_t objects_per_slab;
+    uint32_t first_object;          // offset of the first object from the start of a slab
+    struct slab_t * partial;        // slabs with at least one free object
+    struct slab_t * full;           // slabs with no free objects
+    // counters
+    uint32_t num_slabs;             // slabs currently owned by the cache
+    uint32_t num_active;            // objects currently allocated
+    uint32_t total_allocs;          // objects ever allocated
+    uint32_t total_frees;           // objects ever freed
+    uint32_t failed_allocs;         // allocations that ran out of memory
+} kmem_cache_t;
+
+/* Sets up a cache for objects of the given size, caches are declared statically by their owners */
+void kmem_cache_init(kmem_cache_t * cache, const char * name, uint32_t object_size);
+
+/* Takes an object from a cache, returns NULL when out of memory */
+void * kmem_cache_alloc(kmem_cache_t * cache);
+
+/* Gives an object back to the cache it came from */
+void kmem_cache_free(kmem_cache_t * cache, void * object);
+
+/* Sets up the kmalloc size classes, needs the page allocator */
+void kmalloc_init(void);
+
+/* Allocates size bytes of kernel memory, returns NULL when out of memory */
+void * kmalloc(uint32_t size);
+
+/* Frees memory from kmalloc, NULL is ignored */
+void kfree(void * ptr);
+
+/* Prints the counters of every kmalloc size class and the given caches */
+void kmem_print_stats(kmem_cache_t ** caches, uint32_t num_caches);
+
+#endif
@@ -1,12 +1,138 @@
 #include "syscalls.h"
 
-uint8_t active[NUM_MAX_PROCESSES] = {INACTIVE};
 uint32_t curr_process = 0;
 
+/* load_process_image
+ * DESCRIPTION: builds a new, empty address space for a process and checks the
+ *              program. Nothing is loaded here, the whole 4MB program window is
+ *              demand paged by fault_in_user_page
+ * INPUTS: pcb of the new process, name of the executable
+ * OUTPUTS: fills in the PCB's page_directory, video_page_table, image and current_eip
+ * RETURN VALUE: 0 on success, -1 if the program is missing or memory runs out
+ * SIDE EFFECTS: allocates the page directory
+ */
+static int32_t load_process_image(pcb_t * pcb, const uint8_t* filename)
+{
+  if (open_program(filename, &pcb->image) == -1)
+    return -1;
+
+  pcb->page_directory = create_page_directory();
+  pcb->video_page_table = NULL;
+  if (pcb->page_directory == NULL)
+    return -1;
+
+  pcb->current_eip = pcb->image.entry;
+  return 0;
+}
+
+/* fault_in_mapped_page
+ * DESCRIPTION: handles a not-present fault in an mmap area. Pages mmap could
+ *              not map straight from the filesystem image (the partial last page,
+ *              or blocks with changes not yet written back) get a read-only copy
+ * INPUTS: the current process, faulting virtual address in [MMAP_BASE, MMAP_END)
+ * OUTPUTS: maps and fills the page
+ * RETURN VALUE: 0 if the page is now present, -1 if it is past the end of the file or memory runs out
+ * SIDE EFFECTS: allocates a frame and maybe a page table
+ */
+static int32_t fault_in_mapped_page(pcb_t * pcb, uint32_t addr)
+{
+  mapped_file_t * mapped = &pcb->mapped_files[(addr - MMAP_BASE) / MB_4];
+  uint32_t offset = (addr - MMAP_BASE) % MB_4 & PAGE_ADDR_MASK;
+  uint32_t page = addr & PAGE_ADDR_MASK;
+  uint32_t frame, flags;
+  int32_t ret;
+  uint8_t * shared;
+
+  if (!mapped->used || offset >= mapped->size)
+    return -1;
+
+  shared = file_page_address(mapped->inode, mapped->size, offset);
+  if (shared != NULL)
+    return map_page(pcb->page_directory, page, (uint32_t) shared, PAGE_USER | PAGE_PRESENT);
+
+  frame = alloc_pages(ALLOC_USER, 0);
+  if (frame == 0)
+    return -1;
+
+  //fill it through the kmap slot, the user mapping is read-only
+  cli_and_save(flags);
+  ret = read_file_page(mapped->inode, mapped->size, offset, (uint8_t *) kmap(frame));
+  kunmap();
+  restore_flags(flags);
+
+  if (ret == -1 || map_page(pcb->page_directory, page, frame, PAGE_OWNED | PAGE_USER | PAGE_PRESENT) == -1){
+    free_pages(frame, 0);
+    return -1;
+  }
+  return 0;
+}
+
+/* fault_in_user_page
+ * DESCRIPTION: handles a not-present fault in the current process's program
+ *              window or one of its mmap areas. Whole pages of the executable are mapped read-only and
+ *              copy-on-write straight onto the filesystem image, so every
+ *              process running the same program shares them. Other pages get a
+ *              frame: the partial last page of the file is read in, the rest
+ *              (.bss, stack) start zeroed
+ * INPUTS: faulting virtual address
+ * OUTPUTS: maps and fills the page
+ * RETURN VALUE: 0 if the page is now present, -1 if the address is not ours or memory runs out
+ * SIDE EFFECTS: allocates a frame and maybe a page table
+ */
+int32_t fault_in_user_page(uint32_t addr)
+{
+  pcb_t * pcb = getCurrentProcessPCB();
+  uint32_t page = addr & PAGE_ADDR_MASK;
+  uint32_t frame;
+  uint8_t * shared;
+
+  if (pcb->page_directory != NULL && addr >= MMAP_BASE && addr < MMAP_END)
+    return fault_in_mapped_page(pcb, addr);
+  if (pcb->page_directory == NULL || addr < MB_128 || addr >= USER_STACK_TOP)
+    return -1;
+
+  if (page >= V_PROGRAM_BASE){
+    shared = program_page_address(&pcb->image, page - V_PROGRAM_BASE);
+    if (shared != NULL)
+      return map_page(pcb->page_directory, page, (uint32_t) shared, PAGE_COW | PAGE_USER | PAGE_PRESENT);
+  }
+
+  frame = alloc_pages(ALLOC_USER, 0);
+  if (frame == 0)
+    return -1;
+  if (map_page(pcb->page_directory, page, frame, PAGE_OWNED | PAGE_USER | PAGE_RW | PAGE_PRESENT) == -1){
+    free_pages(frame, 0);
+    return -1;
+  }
+
+  //the entry was not present so there is nothing stale in the TLB, fill it through its user address
+  if (page >= V_PROGRAM_BASE)
+    return read_program_page(&pcb->image, page - V_PROGRAM_BASE, (uint8_t *) page);
+  memset((uint8_t *) page, 0, KB_4);
+  return 0;
+}
+
+/* fault_copy_on_write
+ * DESCRIPTION: handles a write fault on a present page in the current
+ *              process's program window by giving it a private copy
+ * INPUTS: faulting virtual address
+ * OUTPUTS: remaps the page writable
+ * RETURN VALUE: 0 if the write can be retried, -1 if the page is not copy-on-write
+ * SIDE EFFECTS: allocates a frame
+ */
+int32_t fault_copy_on_write(uint32_t addr)
+{
+  pcb_t * pcb = getCurrentProcessPCB();
+
+  if (pcb->page_directory == NULL || addr < MB_128 || addr >= USER_STACK_TOP)
+    return -1;
+  return copy_on_write(pcb->page_directory, addr);
+}
+
 /* open
  * DESCRIPTION: system call for open
  * INPUTS: filename as character array
- * OUTPUTS: opens corresponding file/device/directory and populates file_array,
+ * OUTPUTS: opens corresponding file/device/directory and populates the descriptor table,
  * 					calls file's open function
  * RETURN VALUE: 0 on success, -1 on fail
  * SIDE EFFECTS: populates file array
@@ -16,33 +142,15 @@ int32_t open(const uint8_t* filename)
   // fill dentry with dentry corresponding to filename
   dentry_t dentry;
   // check if file exists. if not, return -1
+  if (filename == NULL || strlen((int8_t*) filename) > MAX_PATH_LEN)
+    return -1;
   if (read_dentry_by_name(filename, &dentry) == -1){
     return -1;
   }
 
-  //check for file type
-  // if rtc file, rtc_open
-  if (dentry.filetype == 0) // devices are type 0
-  {
-    if (file_open(filename) == -1) // create RTC entry in file_array
-        return -1;
-    return file_open(filename);
-  }
-  // if directory file, directory_open
-  else if (dentry.filetype == 1) // directories are type 1
-  {
-    return directory_open(filename);
-  }
-  // if normal file, file_open
-  else if (dentry.filetype == 2) // regular files are type 2
-  {
-    return file_open(filename);
-  }
-  // if none of the files above, return -1
-  else
-  {
-    return -1;
-  }
+  // devices (type 0), directories (type 1) and regular files (type 2) all open the
+  // same way from here, with the dentry we already have
+  return open_dentry(&dentry);
 }
 
 /* close
@@ -55,13 +163,13 @@ int32_t open(const uint8_t* filename)
  */
 int32_t close(int32_t fd)
 {
-  file_t * file_array = getCurrentProcessPCB()->file_array;
-  if(fd < 2 || fd > 7) // don't close stdin or stdout, or anything out of bounds
+  file_t * file = get_file(fd);
+  if(fd < 2) // don't close stdin or stdout
     return -1;
-  if(file_array[fd].flags == FILE_AVAIL) // If file isn't open, don't bother closing it
+  if(file == NULL) // If file isn't open, don't bother closing it
     return -1;
 
-  int32_t * fp = (int32_t *) file_array[fd].file_ops_table_ptr;
+  int32_t * fp = (int32_t *) file->file_ops_table_ptr;
   CLS closer = (CLS) fp[CLOSE];
   return (*closer)(fd);
   }
@@ -75,13 +183,11 @@ int32_t close(int32_t fd)
  */
 int32_t read(int32_t fd, void* buf, int32_t nbytes) // uint8_t* instead of void*
 {
-  file_t * file_array = getCurrentProcessPCB()->file_array;
-  if (fd < 0 || fd > 7) // trying to read from invalid fd
-    return -1;
-  if(file_array[fd].flags == FILE_AVAIL) // file is not open
+  file_t * file = get_file(fd);
+  if(file == NULL) // invalid fd or file is not open
     return -1;
 
-  int32_t * fp = (int32_t *) file_array[fd].file_ops_table_ptr;
+  int32_t * fp = (int32_t *) file->file_ops_table_ptr;
   RD reader = (RD) fp[READ];
   return (*reader)(fd, buf, nbytes);
 }
@@ -95,13 +201,11 @@ int32_t read(int32_t fd, void* buf, int32_t nbytes) // uint8_t* instead of void*
  */
 int32_t write(int32_t fd, const void* buf, int32_t nbytes) // uint8_t* instead of void*
 {
-  file_t * file_array = getCurrentProcessPCB()->file_array;
-  if (fd < 0 || fd > 7) // trying to write to invalid fd
-    return -1;
-  if(file_array[fd].flags == FILE_AVAIL) // file is not open
+  file_t * file = get_file(fd);
+  if(file == NULL) // invalid fd or file is not open
     return -1;
 
-  int32_t * fp = (int32_t *) file_array[fd].file_ops_table_ptr;
+  int32_t * fp = (int32_t *) file->file_ops_table_ptr;
   WRT writer = (WRT) fp[WRITE];
   return (*writer)(fd, buf, nbytes);
 }
@@ -124,33 +228,52 @@ int32_t halt(uint8_t status)
   uint32_t iter;
 
   // close open files in current process
-  for (iter = 2; iter < NUM_MAX_OPEN_FILES; iter++)
+  for (iter = 2; iter < current_pcb->fd_table.size; iter++)
   {
     close(iter);
   }
 
+  //a forked process has nobody blocked in execute on it, tear it down and run whoever is next
+  //it isn't in the run queue while running, and schedule leaves the PCB and this stack
+  //for the next task to free, interrupts stay off until it has switched away
+  if(current_pcb->forked){
+      switch_page_directory(kernel_page_directory);
+      if(current_pcb->video_page_table != NULL)
+          remove_video_mapper(curr_process);
+      destroy_page_directory(current_pcb->page_directory);
+      current_pcb->state = TASK_ZOMBIE;
+      schedule();
+  }
+
+  //a program that leaves its terminal raw shouldn't leave the shell reading raw keys
+  terminal_set_mode(current_pcb->terminal_index, TERMINAL_MODE_CANONICAL);
+
   //check if this is a root shell
   if(parent_process == 0){
       //Root shell, don't allow (true) exit, just restart
-      uint8_t *program_image_storage_location = (uint8_t *) V_PROGRAM_BASE;
-      uint32_t eip = program_image_storage_location[24];
-      eip |= program_image_storage_location[25] << 8;
-      eip |= program_image_storage_location[26] << 16;
-      eip |= program_image_storage_location[27] << 24;
-
+      //drop the old instance's mmap areas, the new one starts with none
+      for (iter = 0; iter < NUM_MAX_MAPPED_FILES; iter++)
+        munmap((uint8_t *) (MMAP_BASE + iter * MB_4));
       //Start new instance of shell
-      context_switch(eip, MB_128 + MB_4 - B_4,0);
+      context_switch(current_pcb->image.entry, USER_STACK_TOP - B_4,0);
   }
 
   //restore parent paging
-  loadPageDirectory(page_directory_array[parent_process - 1]);
+  switch_page_directory(getProcessPCB(parent_process)->page_directory);
   terminals[current_pcb->terminal_index].active_process = parent_process;
 
   // set esp0 in TSS
   tss.esp0 = get_kernel_stack_bottom(parent_process);
 
-  //decrement number of processes
-  active[curr_process - 1] = INACTIVE;
+  //the parent was blocked in execute and picks up right where it left off
+  current_pcb->state = TASK_ZOMBIE;
+  getProcessPCB(parent_process)->state = TASK_RUNNING;
+
+  //give the address space, PID and kernel stack back, interrupts stay off until we are on the parent's stack
+  if(current_pcb->video_page_table != NULL)
+      remove_video_mapper(curr_process);
+  destroy_page_directory(current_pcb->page_directory);
+  free_pid(curr_process);
   curr_process = parent_process;
 
   //jump to execute return
@@ -171,34 +294,28 @@ int32_t execute(const uint8_t* command)
 {
   int i, j;
   uint32_t process_id;
-  uint8_t filename[FILENAME_LEN];
-  uint32_t eip, flags;
-  uint8_t* program_image_storage_location = (uint8_t *) V_PROGRAM_BASE; // location to load program
+  int32_t pid;
+  uint8_t filename[MAX_PATH_LEN + 1];
+  uint32_t flags;
   uint32_t bottom_addr_of_page;
   int32_t status;
   pcb_t * child_pcb;
 
   cli_and_save(flags);
-  //check which program pages are not being used in the kernel
-  //after this loop, i contains lowest program page that is available
-  for (process_id = 0; process_id < NUM_MAX_PROCESSES; process_id++){
-    if (active[process_id] == INACTIVE){
-      break;
-    }
-  }
+  //grab the lowest free PID (1-based) along with its kernel stack
+  pid = alloc_pid();
 
   //maximum number of processes ongoing; return -1
-  if (process_id == NUM_MAX_PROCESSES){
+  if (pid == -1){
     return -1;
   }
-
-  //Process ID is going to be 1-based
-  process_id++;
+  process_id = pid;
 
   child_pcb = getProcessPCB(process_id);
 
   //get filename from command
-  for (i = 0; i < FILENAME_LEN; i++){
+  filename[MAX_PATH_LEN] = 0;
+  for (i = 0; i < MAX_PATH_LEN; i++){
     //if space character, break
     if (command[i] == ' '){
       //postincrementing in command[i] causes warning so I moved it out
@@ -228,33 +345,18 @@ int32_t execute(const uint8_t* command)
     }
   }
 
-  //set up program paging and increment number of processes
-  //Also, set which 4MB program pages are being used
-  //Since page directories are 0-based, subtract one from process id
-  loadPageDirectory(page_directory_array[process_id - 1]);
-
-  // load program into memory, return -1 if fails
-  if (load_program(filename, program_image_storage_location) == -1){
-      loadPageDirectory(page_directory_array[curr_process - 1]);
+  // this should set files for stdin and stdout in file array
+  // then build the child's address space and load the program into it, return -1 if fails
+  if (init_fd_table(&child_pcb->fd_table) == -1 ||
+      load_process_image(child_pcb, filename) == -1){
+      free_pid(process_id);
       return -1;
   }
-
-  active[process_id - 1] = ACTIVE;
+  switch_page_directory(child_pcb->page_directory);
 
   //save esp first in TSS
   tss.esp0 = get_kernel_stack_bottom(process_id);
 
-  //create PCB
-  // this should set files for stdin and stdout in file array
-  init_file_array(child_pcb->file_array);
-
-  //copy entry point to eip - bytes 24-27
-  eip = 0;
-  eip |= program_image_storage_location[24];
-  eip |= program_image_storage_location[25] << 8;
-  eip |= program_image_storage_location[26] << 16;
-  eip |= program_image_storage_location[27] << 24;
-
   //store parent process number in PCB
   child_pcb->parent_num = curr_process;
 
@@ -267,12 +369,27 @@ int32_t execute(const uint8_t* command)
   asm("\t movl %%esp,%0" : "=r"(child_pcb->parent_esp));
   asm("\t movl %%ebp,%0" : "=r"(child_pcb->parent_ebp));
 
+  //parent sleeps until the child halts, child inherits the parent's priority
+  if (curr_process != 0){
+    getCurrentProcessPCB()->state = TASK_BLOCKED;
+    child_pcb->priority = getCurrentProcessPCB()->priority;
+  }
+  else{
+    child_pcb->priority = DEFAULT_PRIORITY;
+  }
+  child_pcb->state = TASK_RUNNING;
+  child_pcb->next_ready = 0;
+  child_pcb->prev_ready = 0;
+  child_pcb->next_waiting = 0;
+  child_pcb->rtc_count = 0;
+  init_wait_queue(&child_pcb->rtc_wait);
+
   //set current process as the process being switched into
   curr_process = process_id;
 
   //perform the context switch
-  bottom_addr_of_page = MB_128 + MB_4 - B_4;
-  context_switch(eip, bottom_addr_of_page,0);
+  bottom_addr_of_page = USER_STACK_TOP - B_4;
+  context_switch(child_pcb->current_eip, bottom_addr_of_page,0);
 
   end_of_execute:;
   //move eax into status
@@ -283,6 +400,137 @@ int32_t execute(const uint8_t* command)
   return status;
 }
 
+/* fork
+ * DESCRIPTION: system call for fork, clones the calling process. The child
+ *              shares every page copy-on-write and every open file, and returns
+ *              0 from the same system call the parent gets its PID back from
+ * INPUTS: none
+ * OUTPUTS: puts the new process in the run queue
+ * RETURN VALUE: PID of the child in the parent, 0 in the child, -1 if no process is free or out of memory
+ * SIDE EFFECTS: write protects the parent's writable pages
+ */
+int32_t fork(void)
+{
+  uint32_t flags;
+  int32_t pid;
+  pcb_t * parent = getCurrentProcessPCB();
+  pcb_t * child;
+  uint8_t * child_frame;
+
+  cli_and_save(flags);
+  pid = alloc_pid();
+
+  //maximum number of processes ongoing; return -1
+  if (pid == -1){
+    restore_flags(flags);
+    return -1;
+  }
+  child = getProcessPCB(pid);
+
+  child->page_directory = clone_page_directory(parent->page_directory);
+  if (child->page_directory == NULL){
+    free_pid(pid);
+    restore_flags(flags);
+    return -1;
+  }
+
+  //open files are shared, including their offsets
+  if (clone_fd_table(&child->fd_table, &parent->fd_table) == -1){
+    destroy_page_directory(child->page_directory);
+    free_pid(pid);
+    restore_flags(flags);
+    return -1;
+  }
+
+  memcpy(child->arg, parent->arg, TERMINAL_BUFFER_SIZE);
+  child->num_char_in_arg = parent->num_char_in_arg;
+  child->terminal_index = parent->terminal_index;
+  child->image = parent->image;
+  memcpy(child->mapped_files, parent->mapped_files, sizeof(parent->mapped_files));
+  child->priority = parent->priority;
+  child->parent_num = 0;
+  child->forked = 1;
+  init_wait_queue(&child->rtc_wait);
+
+  //the clone maps the same screen, so it has to follow the terminal's screen around too
+  child->video_page_table = NULL;
+  if (parent->video_page_table != NULL){
+    child->video_page_table = get_page_table(child->page_directory, MB_256, 0);
+    add_video_mapper(pid);
+  }
+
+  //the child starts in fork_return, which IRETs to user space with a copy of our registers
+  child_frame = (uint8_t *) get_kernel_stack_bottom(pid) - SYSCALL_FRAME_SIZE;
+  memcpy(child_frame, (uint8_t *) get_kernel_stack_bottom(curr_process) - SYSCALL_FRAME_SIZE, SYSCALL_FRAME_SIZE);
+  child->current_eip = (uint32_t) fork_return;
+  child->current_esp = (uint32_t) child_frame;
+  child->current_ebp = (uint32_t) child_frame;
+  child->is_user_mode = 0;
+
+  enqueue_task(pid);
+  restore_flags(flags);
+  return pid;
+}
+
+/* launch_shell
+ * DESCRIPTION: starts a root shell on a terminal. The shell does not run right
+ *              away, it is put in the run queue for the scheduler to start
+ * INPUTS: terminal_index - the terminal the shell reads from and writes to
+ * OUTPUTS: loads the shell program into a free process's memory
+ * RETURN VALUE: PID of the new shell, -1 if no process is free or loading fails
+ * SIDE EFFECTS: modifies PCB, run queue and the terminal's active process
+ */
+int32_t launch_shell(uint8_t terminal_index)
+{
+  uint32_t process_id, flags;
+  int32_t pid;
+  pcb_t * shell;
+
+  cli_and_save(flags);
+  pid = alloc_pid();
+
+  //maximum number of processes ongoing; return -1
+  if (pid == -1){
+    restore_flags(flags);
+    return -1;
+  }
+  process_id = pid;
+  shell = getProcessPCB(process_id);
+
+  //Write the shell to its own address space, we stay in whatever address space we were in
+  if (init_fd_table(&shell->fd_table) == -1 ||
+      load_process_image(shell, (uint8_t *)"shell") == -1){
+    free_pid(process_id);
+    restore_flags(flags);
+    return -1;
+  }
+
+  shell->arg[0] = 0;
+  shell->num_char_in_arg = 1;
+  shell->parent_num = 0;
+  shell->terminal_index = terminal_index;
+  shell->parent_esp = 0;
+  shell->parent_ebp = 0;
+  shell->exec_ret_addr = 0;
+
+  //first switch to the shell IRETs straight into user mode at its entry point
+  shell->current_ebp = 0;
+  shell->current_esp = USER_STACK_TOP - B_4;
+  shell->is_user_mode = 1;
+
+  //Hand the new shell to the scheduler
+  shell->priority = DEFAULT_PRIORITY;
+  shell->next_waiting = 0;
+  shell->rtc_count = 0;
+  init_wait_queue(&shell->rtc_wait);
+  enqueue_task(process_id);
+
+  //Mark the terminal as having an active program on it
+  terminals[terminal_index].active_process = process_id;
+  restore_flags(flags);
+  return process_id;
+}
+
 /* getargs
  * DESCRIPTION: system call for getargs
  * INPUTS: pointer to buffer, number of bytes
@@ -327,42 +575,37 @@ int32_t getargs(uint8_t* buf, int32_t nbytes)
  */
 int32_t vidmap(uint8_t** screen_start)
 {
-  int i;
   uint32_t flags;
+  pcb_t * current_pcb = getCurrentProcessPCB();
   cli_and_save(flags);
   //if location is invalid, return -1
   //Check if address of screen_start is within the address range covered
   //by the single user-level page for the process.
   //0x8000000 is 128MB, 0x400000 is 4MB
-  //I'm making assumptions about process mapping from virtual to physical
-  //Specifically, process 0 is mapped to 128-132MB page, process 1 to 132-136MB page
   if (screen_start == NULL ||
      (uint32_t) screen_start > MB_128 + MB_4 - B_4 ||
      (uint32_t) screen_start < MB_128){
+    restore_flags(flags);
     return -1;
   }
 
-  // map text-mode video memory into user space at virtual 256MB
-  *screen_start = (uint8_t*) MB_256; // 256 MB
-
-  //set paging for that virtual address
-  //initialize first page table containing video memory (video memory at location 0xB8000)
-  video_mem_page_table[curr_process - 1][0] = (184 * KB_4) | 7;
-  for(i = 1; i < NUM_ENTRIES; i++)
-  {
-    // As the address is page aligned, it will always leave 12 bits zeroed.
-    // attributes: supervisor level, read/write, present.
-    //set video memory page table to point to addresses starting at 0MB
-    //184 because video memory is mapped to physical 0xB8000
-    //
-    video_mem_page_table[curr_process - 1][i] = (i * KB_4) | 6;
+  //map the process's terminal screen into user space at virtual 256MB
+  //(video memory while the screen has a page of it, its storage page otherwise)
+  if (map_page(current_pcb->page_directory, MB_256,
+               (uint32_t) terminals[current_pcb->terminal_index].video_start,
+               PAGE_USER | PAGE_RW | PAGE_PRESENT) == -1){
+    restore_flags(flags);
+    return -1;
   }
-
-  //Map from virtual 256MB to 0MB
-  page_directory_array[curr_process - 1][64] = ((unsigned int) video_mem_page_table[curr_process - 1]) | 7;
+  //the terminal remaps everyone on its list when its screen moves
+  if (current_pcb->video_page_table == NULL){
+    current_pcb->video_page_table = get_page_table(current_pcb->page_directory, MB_256, 0);
+    add_video_mapper(curr_process);
+  }
+  *screen_start = (uint8_t*) MB_256; // 256 MB
 
   //Flush TLB
-  loadPageDirectory(page_directory_array[curr_process - 1]);
+  flush_tlb();
   restore_flags(flags);
 
   return 0;
@@ -394,24 +637,277 @@ int32_t sigreturn(void)
   return -1;
 }
 
-/*
- * pcb_t * getCurrentProcessPCB()
- *   DESCRIPTION: returns pointer to the current PCB
- *   INPUTS: none
- *   OUTPUTS: none
- *   RETURN VALUE: A pointer to the active PCB
- *   SIDE EFFECTS: none
+/* creat
+ * DESCRIPTION: system call for creat, opens a regular file for writing from
+ *              the start, creating it if it doesn't exist and emptying it if it does
+ * INPUTS: path of the file as character array
+ * OUTPUTS: populates the descriptor table
+ * RETURN VALUE: fd on success, -1 on a bad path, a name that isn't a regular
+ *               file, a file that is running or mmapped, or a full directory
+ * SIDE EFFECTS: may add a file to the filesystem
  */
-pcb_t * getCurrentProcessPCB(){
-  uint32_t esp;
-  asm volatile ("\t movl %%esp,%0" : "=r"(esp));
-  return (pcb_t *)(esp & ~(PCB_MASK));
+int32_t creat(const uint8_t* filename)
+{
+  dentry_t dentry;
+
+  if (filename == NULL || strlen((int8_t*) filename) > MAX_PATH_LEN)
+    return -1;
+
+  if (read_dentry_by_name(filename, &dentry) == -1){
+    if (create_file(filename, 2) == -1 || read_dentry_by_name(filename, &dentry) == -1)
+      return -1;
+  }
+  else if (dentry.filetype != 2 || truncate_file(dentry.inode_num) == -1){
+    return -1;
+  }
+
+  return open_dentry(&dentry);
 }
 
-pcb_t * getProcessPCB(uint32_t pid){
-  return (pcb_t *)(P_PROCESS_BASE - (pid + 1) * P_PROCESS_OFFSET);
+/* mmap
+ * DESCRIPTION: system call for mmap, maps an open regular file read-only into
+ *              a free 4MB area of the caller's address space. Pages that can
+ *              come straight from the filesystem image are mapped right away,
+ *              the rest are copied in when they are first touched
+ * INPUTS: file descriptor, where to store the start of the mapping
+ * OUTPUTS: sets *start
+ * RETURN VALUE: length of the file in bytes (the size of the mapping), -1 if fd
+ *               is not an open regular file, start is outside the program's
+ *               window, every area is in use, or there is no memory for the page table
+ * SIDE EFFECTS: modifies the page tables
+ */
+int32_t mmap(int32_t fd, uint8_t** start)
+{
+  pcb_t * pcb = getCurrentProcessPCB();
+  mapped_file_t * mapped;
+  uint32_t i, offset, base, flags;
+  int32_t size;
+  uint8_t * shared;
+
+  if (start == NULL || (uint32_t) start < MB_128 || (uint32_t) start > USER_STACK_TOP - B_4)
+    return -1;
+  size = file_size(get_file(fd));
+  if (size == -1)
+    return -1;
+
+  cli_and_save(flags);
+  for (i = 0; i < NUM_MAX_MAPPED_FILES; i++){
+    if (!pcb->mapped_files[i].used)
+      break;
+  }
+  if (i == NUM_MAX_MAPPED_FILES){
+    restore_flags(flags);
+    return -1;
+  }
+  mapped = &pcb->mapped_files[i];
+  mapped->used = 1;
+  mapped->inode = get_file(fd)->inode_num;
+  mapped->size = size;
+  base = MMAP_BASE + i * MB_4;
+
+  //the area was unmapped, so the TLB holds nothing for it
+  for (offset = 0; offset < (uint32_t) size; offset += KB_4){
+    shared = file_page_address(mapped->inode, mapped->size, offset);
+    if (shared == NULL)
+      continue;
+    if (map_page(pcb->page_directory, base + offset, (uint32_t) shared, PAGE_USER | PAGE_PRESENT) == -1){
+      //out of memory for the page table, undo the pages mapped so far like munmap would
+      unmap_page_table(pcb->page_directory, base);
+      mapped->used = 0;
+      flush_tlb();
+      restore_flags(flags);
+      return -1;
+    }
+  }
+  restore_flags(flags);
+
+  *start = (uint8_t *) base;
+  return size;
 }
 
-uint32_t get_kernel_stack_bottom(uint32_t pid){
-  return P_PROCESS_BASE - pid * P_PROCESS_OFFSET - B_4;
+/* munmap
+ * DESCRIPTION: system call for munmap, removes a mapping made by mmap
+ * INPUTS: start of the mapping, as returned by mmap
+ * OUTPUTS: none
+ * RETURN VALUE: 0 on success, -1 if nothing is mapped there
+ * SIDE EFFECTS: modifies the page tables, flushes the TLB
+ */
+int32_t munmap(uint8_t* start)
+{
+  pcb_t * pcb = getCurrentProcessPCB();
+  uint32_t addr = (uint32_t) start;
+  uint32_t flags;
+  mapped_file_t * mapped;
+
+  if (addr < MMAP_BASE || addr >= MMAP_END || (addr - MMAP_BASE) % MB_4 != 0)
+    return -1;
+  mapped = &pcb->mapped_files[(addr - MMAP_BASE) / MB_4];
+
+  cli_and_save(flags);
+  if (!mapped->used){
+    restore_flags(flags);
+    return -1;
+  }
+  unmap_page_table(pcb->page_directory, addr);
+  mapped->used = 0;
+  flush_tlb();
+  restore_flags(flags);
+  return 0;
+}
+
+/* readv
+ * DESCRIPTION: system call for readv, reads into several buffers in turn with
+ *              one system call. Stops early when a read comes up short, the
+ *              way the single read that filled it would have returned
+ * INPUTS: file descriptor, array of buffers, number of buffers
+ * OUTPUTS: fills the buffers in order
+ * RETURN VALUE: total number of bytes read, -1 if the arguments are bad or the
+ *               first read fails
+ * SIDE EFFECTS: advances the file position like read
+ */
+int32_t readv(int32_t fd, const iovec_t* iov, int32_t iovcnt)
+{
+  file_t * file = get_file(fd);
+  int32_t i, ret, total = 0;
+
+  if (file == NULL || iov == NULL || iovcnt < 0 || iovcnt > IOV_MAX)
+    return -1;
+
+  int32_t * fp = (int32_t *) file->file_ops_table_ptr;
+  RD reader = (RD) fp[READ];
+  for (i = 0; i < iovcnt; i++){
+    if (iov[i].len < 0)
+      return (total > 0) ? total : -1;
+    ret = (*reader)(fd, iov[i].base, iov[i].len);
+    if (ret == -1)
+      return (total > 0) ? total : -1;
+    total += ret;
+    if (ret < iov[i].len)
+      break;
+  }
+  return total;
+}
+
+/* writev
+ * DESCRIPTION: system call for writev, writes several buffers in turn with
+ *              one system call
+ * INPUTS: file descriptor, array of buffers, number of buffers
+ * OUTPUTS: writes the buffers in order
+ * RETURN VALUE: total number of bytes written, -1 if the arguments are bad or
+ *               the first write fails
+ * SIDE EFFECTS: advances the file position like write
+ */
+int32_t writev(int32_t fd, const iovec_t* iov, int32_t iovcnt)
+{
+  file_t * file = get_file(fd);
+  int32_t i, ret, total = 0;
+
+  if (file == NULL || iov == NULL || iovcnt < 0 || iovcnt > IOV_MAX)
+    return -1;
+
+  int32_t * fp = (int32_t *) file->file_ops_table_ptr;
+  WRT writer = (WRT) fp[WRITE];
+  for (i = 0; i < iovcnt; i++){
+    if (iov[i].len < 0)
+      return (total > 0) ? total : -1;
+    ret = (*writer)(fd, iov[i].base, iov[i].len);
+    if (ret == -1)
+      return (total > 0) ? total : -1;
+    total += ret;
+    if (ret < iov[i].len)
+      break;
+  }
+  return total;
+}
+
+/* pread
+ * DESCRIPTION: system call for pread, reads at an explicit offset without
+ *              moving the file position. The offset is the 4th argument, in %esi
+ * INPUTS: file descriptor, buffer, number of bytes, offset in the file
+ * OUTPUTS: calls the file type's pread function
+ * RETURN VALUE: number of bytes read, -1 on failure or for files without positions
+ * SIDE EFFECTS: none
+ */
+int32_t pread(int32_t fd, void* buf, int32_t nbytes, uint32_t offset)
+{
+  file_t * file = get_file(fd);
+  if(file == NULL) // invalid fd or file is not open
+    return -1;
+
+  int32_t * fp = (int32_t *) file->file_ops_table_ptr;
+  PRD reader = (PRD) fp[PREAD];
+  return (*reader)(fd, buf, nbytes, offset);
+}
+
+/* pwrite
+ * DESCRIPTION: system call for pwrite, writes at an explicit offset without
+ *              moving the file position. The offset is the 4th argument, in %esi
+ * INPUTS: file descriptor, buffer, number of bytes, offset in the file
+ * OUTPUTS: calls the file type's pwrite function
+ * RETURN VALUE: number of bytes written, -1 on failure or for files without positions
+ * SIDE EFFECTS: none
+ */
+int32_t pwrite(int32_t fd, const void* buf, int32_t nbytes, uint32_t offset)
+{
+  file_t * file = get_file(fd);
+  if(file == NULL) // invalid fd or file is not open
+    return -1;
+
+  int32_t * fp = (int32_t *) file->file_ops_table_ptr;
+  PWRT writer = (PWRT) fp[PWRITE];
+  return (*writer)(fd, buf, nbytes, offset);
+}
+
+/* getdents
+ * DESCRIPTION: system call for getdents, reads a batch of directory entries
+ * INPUTS: file descriptor of an open directory, buffer, size of the buffer
+ * OUTPUTS: calls the file type's getdents function
+ * RETURN VALUE: number of bytes of dirent_t records filled, 0 at the end of the
+ *               directory, -1 if fd is not a directory or the buffer is too small
+ * SIDE EFFECTS: none
+ */
+int32_t getdents(int32_t fd, void* buf, int32_t nbytes)
+{
+  file_t * file = get_file(fd);
+  if(file == NULL) // invalid fd or file is not open
+    return -1;
+
+  int32_t * fp = (int32_t *) file->file_ops_table_ptr;
+  GETD reader = (GETD) fp[GETDENTS];
+  return (*reader)(fd, buf, nbytes);
+}
+
+/* mkdir
+ * DESCRIPTION: system call for mkdir, adds an empty directory
+ * INPUTS: path of the new directory as character array, everything before the
+ *         last component must already exist
+ * OUTPUTS: a new directory in the filesystem
+ * RETURN VALUE: 0 on success, -1 on a bad path, a name that already exists, or a
+ *               full directory or filesystem
+ * SIDE EFFECTS: writes the change back to the image
+ */
+int32_t mkdir(const uint8_t* path)
+{
+  if (path == NULL || create_file(path, 1) == -1)
+    return -1;
+  return block_cache_sync();
+}
+
+/* ioctl
+ * DESCRIPTION: system call for ioctl, device specific requests. Terminals take
+ *              TERMINAL_GET_MODE and TERMINAL_SET_MODE to pick a line discipline
+ * INPUTS: file descriptor, request, argument of the request
+ * OUTPUTS: calls the file type's ioctl function
+ * RETURN VALUE: depends on the request, -1 if fd is bad or doesn't know the request
+ * SIDE EFFECTS: depends on the request
+ */
+int32_t ioctl(int32_t fd, int32_t request, int32_t arg)
+{
+  file_t * file = get_file(fd);
+  if(file == NULL) // invalid fd or file is not open
+    return -1;
+
+  int32_t * fp = (int32_t *) file->file_ops_table_ptr;
+  IOCT handler = (IOCT) fp[IOCTL];
+  return (*handler)(fd, request, arg);
 }
@@ -10,15 +10,19 @@
 #include "context_switch.h"
 #include "terminal.h"
 #include "pcb.h"
+#include "process.h"
+#include "scheduler.h"
+#include "page_alloc.h"
 
 #define OPEN 0
 #define READ 1
 #define WRITE 2
 #define CLOSE 3
-#define INACTIVE 0
-#define ACTIVE 1
+#define PREAD 4
+#define PWRITE 5
+#define GETDENTS 6
+#define IOCTL 7
 #define P_PROCESS_BASE 0x800000 //P for physical
-#define P_PROCESS_OFFSET 0x2000
 #define V_PROGRAM_BASE 0x8048000 //V for virtual
 #define MB_256 0x10000000
 #define MB_128 0x8000000
@@ -26,20 +30,27 @@
 #define KB_4 0x1000
 #define B_4 4
 #define PCB_MASK 0x1FFF
+// registers system_call_handler saves plus the processor's IRET frame, at the top of the kernel stack
+#define SYSCALL_FRAME_SIZE 64
+#define USER_STACK_TOP (MB_128 + MB_4) //user stack grows down from the end of the program's 4MB window
+#define MMAP_BASE 0x20000000 //mmap areas start at 512MB, one 4MB area per mapped file
+#define MMAP_END (MMAP_BASE + NUM_MAX_MAPPED_FILES * MB_4)
+#define IOV_MAX 16 //most buffers one readv or writev takes
 
 /* global to keep track of the current process
  */
 extern uint32_t curr_process;
 
-/* bitmap for keeping track of what num_processes
- * use which pages
- */
-extern uint8_t active[NUM_MAX_PROCESSES];
-
 extern int32_t open(const uint8_t* filename);
 
 extern int32_t close(int32_t fd);
 
+// one buffer of a readv or writev
+typedef struct iovec_t {
+  void * base;
+  int32_t len;
+} iovec_t;
+
 extern int32_t read(int32_t fd, void* buf, int32_t nbytes); // uint8_t* instead of void*
 
 extern int32_t write(int32_t fd, const void* buf, int32_t nbytes); // uint8_t* instead of void*
@@ -56,18 +67,44 @@ extern int32_t set_handler(int32_t signum, void* handler); // uint8_t* instead o
 
 extern int32_t sigreturn(void);
 
-//Helper function to get current PCB
-pcb_t * getCurrentProcessPCB();
+extern int32_t fork(void);
+
+extern int32_t creat(const uint8_t* filename);
+
+extern int32_t mmap(int32_t fd, uint8_t** start);
+
+extern int32_t munmap(uint8_t* start);
+
+extern int32_t readv(int32_t fd, const iovec_t* iov, int32_t iovcnt);
+
+extern int32_t writev(int32_t fd, const iovec_t* iov, int32_t iovcnt);
+
+extern int32_t pread(int32_t fd, void* buf, int32_t nbytes, uint32_t offset);
+
+extern int32_t pwrite(int32_t fd, const void* buf, int32_t nbytes, uint32_t offset);
+
+extern int32_t getdents(int32_t fd, void* buf, int32_t nbytes);
+
+extern int32_t mkdir(const uint8_t* path);
+
+extern int32_t ioctl(int32_t fd, int32_t request, int32_t arg);
+
+//Helper function for the page fault handler to demand page a process's program window
+int32_t fault_in_user_page(uint32_t addr);
 
-//Helper function to get PCB associated with any process
-pcb_t * getProcessPCB(uint32_t pid);
+//Helper function for the page fault handler to resolve writes to shared pages
+int32_t fault_copy_on_write(uint32_t addr);
 
-//Helper function to get the address of the bottom of any process' kernel stack
-uint32_t get_kernel_stack_bottom(uint32_t pid);
+//Helper function to start a root shell on a terminal
+int32_t launch_shell(uint8_t terminal_index);
 
 // typedefs for function pointers for close, read, write
 typedef int32_t (*CLS)(int32_t);
 typedef int32_t (*RD)(int32_t, void*, int32_t);
 typedef int32_t (*WRT)(int32_t, const void*, int32_t);
+typedef int32_t (*PRD)(int32_t, void*, int32_t, uint32_t);
+typedef int32_t (*PWRT)(int32_t, const void*, int32_t, uint32_t);
+typedef int32_t (*GETD)(int32_t, void*, int32_t);
+typedef int32_t (*IOCT)(int32_t, int32_t, int32_t);
 
 #endif
@@ -1,4 +1,6 @@
 #include "terminal.h"
+#include "slab.h"
+#include "page_alloc.h"
 
 #define CAPS_INDEX     0
 #define L_SHIFT_INDEX  1
@@ -13,6 +15,9 @@
 uint8_t modifiers[7] = {0};             //The various modifiers that can be active
 static int caps_held = 0;
 
+static int8_t page_owner[NUM_TERMINAL_PAGES];  //The terminal drawing into each page of video memory, -1 if free
+static uint32_t switch_count = 0;              //Terminal switches so far, stamps last_shown
+
 //These arrays come from data on OSDev and looking at a QWERTY keyboard
 const char LOWERCASE_SCANCODES[] = {0, 0, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', 0, 0,
                                    'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n', 0, 'a', 's',
@@ -30,6 +35,7 @@ const char CAPSLOCK_SCANCODES[] =  {0, 0, '1', '2', '3', '4', '5', '6', '7', '8'
                                    'B', 'N', 'M', ',', '.', '/', 0, 0, 0, ' ', 0, 0, 0, 0, 0, 0};
 
 void switch_terminal(uint8_t next_terminal_index);
+static void scroll_view(int32_t lines);
 
 /*
  * init_terminal
@@ -44,28 +50,83 @@ void init_terminals(){
 
     for(j = 0; j < NUM_TERMINALS; j++){
         for(i = 0; i < TERMINAL_BUFFER_SIZE; i++)
-            terminals[j].buffer[i] = '\0';
+            terminals[j].line[i] = '\0';
         terminals[j].pos_x = 0;
         terminals[j].pos_y = 0;
-        terminals[j].chars_in_buffer = 0;
+        terminals[j].line_length = 0;
+        terminals[j].mode = TERMINAL_MODE_CANONICAL;
         terminals[j].active_process = -1;
+        ring_init(&terminals[j].input);
+        init_wait_queue(&terminals[j].read_wait);
+        terminals[j].scrollback = NULL;     //init_scrollback hands these out once there is a heap
+        terminals[j].scrollback_head = 0;
+        terminals[j].scrollback_count = 0;
+        terminals[j].view_offset = 0;
+        terminals[j].video_start = NULL;    //No screen until the terminal is first shown
+        terminals[j].storage_location = NULL;
+        terminals[j].vga_page = -1;
+        terminals[j].last_shown = 0;
+        terminals[j].video_mappers = 0;
     }
-    terminals[0].video_start = (uint8_t *) VIDEO_BASE;
-    terminals[1].video_start = (uint8_t *) terminal1_storage;
-    terminals[2].video_start = (uint8_t *) terminal2_storage;
-
-    terminals[0].storage_location = (uint8_t *) terminal0_storage;
-    terminals[1].storage_location = (uint8_t *) terminal1_storage;
-    terminals[2].storage_location = (uint8_t *) terminal2_storage;
+    for(j = 0; j < NUM_TERMINAL_PAGES; j++)
+        page_owner[j] = -1;
 
-    //Set the first terminal to be active
+    //Set the first terminal to be active, drawing into the first page
     active_terminal_index = 0;
+    terminals[0].video_start = (uint8_t *) VIDEO_BASE;
+    terminals[0].vga_page = 0;
+    page_owner[0] = 0;
+    set_display_page(0);
 
     //Clear all of the vram buffers
-    uint32_t k;
-    for(k = VIDEO_BASE; k < terminal2_storage + KB_4; k++)
-        *((uint8_t *) (VIDEO_BASE + k)) = 0;
+    memset_word((uint8_t *) VIDEO_BASE, (ATTRIB << 8) | ' ', VGA_PAGES * VGA_PAGE_CELLS);
+}
+
+/*
+ * init_scrollback
+ *   DESCRIPTION: allocates the scrollback history of every terminal that has a screen
+ *                already, the others get theirs in load_screen. A terminal that doesn't
+ *                get any memory just keeps no history
+ *   INPUTS: none
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: allocates from the kernel heap
+ */
+void init_scrollback(){
+    uint8_t i;
+
+    for(i = 0; i < NUM_TERMINALS; i++){
+        if(terminals[i].video_start != NULL && terminals[i].scrollback == NULL)
+            terminals[i].scrollback = kmalloc((SCROLLBACK_LINES * NUM_COLS) << 1);
+    }
+}
+
+/*
+ * history_line
+ *   DESCRIPTION: finds a line of a terminal's scrollback history
+ *   INPUTS: terminal - the terminal; back - how far back the line is, 1 being the newest
+ *   OUTPUTS: none
+ *   RETURN VALUE: the line's NUM_COLS cells
+ *   SIDE EFFECTS: none
+ */
+static uint8_t * history_line(terminal_t * terminal, uint32_t back){
+    uint32_t slot = (terminal->scrollback_head + SCROLLBACK_LINES - back) % SCROLLBACK_LINES;
 
+    return (uint8_t *) (terminal->scrollback + slot * NUM_COLS);
+}
+
+/*
+ * update_cursor
+ *   DESCRIPTION: moves the hardware cursor to a terminal's position, if the terminal
+ *                is the one on screen and its live screen is being shown
+ *   INPUTS: terminal_index - the terminal
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: may move the cursor
+ */
+static void update_cursor(uint8_t terminal_index){
+    if(terminal_index == active_terminal_index && terminals[terminal_index].view_offset == 0)
+        move_cursor(terminals[terminal_index].pos_x, terminals[terminal_index].pos_y);
 }
 
 /*
@@ -85,8 +146,106 @@ void clear_terminal(uint8_t terminal_index){
       *(uint8_t *)(terminals[terminal_index].video_start + (i << 1) + 1) = ATTRIB;
   }
 
-  if(terminal_index == active_terminal_index)
-      move_cursor(0, 0);
+  update_cursor(terminal_index);
+}
+
+/*
+ * scroll_terminal
+ *   DESCRIPTION: scrolls a terminal's screen up by some number of lines with one
+ *                block move, the lines uncovered at the bottom are blanked. Lines
+ *                leaving the top go on the history ring, one line copy and a head
+ *                bump each. Scrolling by more than a screen also pushes the blank
+ *                lines in between, which render_chars then draws into
+ *   INPUTS: terminal_index - the terminal; lines - how many lines to scroll
+ *   OUTPUTS: modifies the terminal's screen and history
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory if the terminal is active
+ */
+static void scroll_terminal(uint8_t terminal_index, uint32_t lines){
+    terminal_t * terminal = &terminals[terminal_index];
+    uint8_t * screen = terminal->video_start;
+    uint8_t * slot;
+    uint32_t i;
+
+    if(terminal->scrollback != NULL){
+        //Anything older than the ring holds would be overwritten before this returns
+        for(i = (lines > SCROLLBACK_LINES) ? lines - SCROLLBACK_LINES : 0; i < lines; i++){
+            slot = (uint8_t *) (terminal->scrollback + terminal->scrollback_head * NUM_COLS);
+            if(i < NUM_ROWS)
+                memcpy(slot, screen + ((NUM_COLS * i) << 1), NUM_COLS << 1);
+            else
+                memset_word(slot, (ATTRIB << 8) | ' ', NUM_COLS);
+            terminal->scrollback_head = (terminal->scrollback_head + 1) % SCROLLBACK_LINES;
+            if(terminal->scrollback_count < SCROLLBACK_LINES)
+                terminal->scrollback_count++;
+        }
+    }
+
+    if(lines > NUM_ROWS)
+        lines = NUM_ROWS;
+    memmove(screen, screen + ((NUM_COLS * lines) << 1), (NUM_COLS * (NUM_ROWS - lines)) << 1);
+    memset_word(screen + ((NUM_COLS * (NUM_ROWS - lines)) << 1), (ATTRIB << 8) | ' ', NUM_COLS * lines);
+}
+
+/*
+ * render_chars
+ *   DESCRIPTION: draws a run of characters on a terminal's screen. A first pass
+ *                works out where the run ends, so the screen scrolls once, by
+ *                every line the run needs, before anything is drawn. Characters
+ *                that would scroll off the top again are drawn straight into the history
+ *   INPUTS: terminal_index - the terminal; buffer, count - the characters
+ *           attribute - the attribute byte to draw them with
+ *   OUTPUTS: modifies the terminal's screen and position
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: writes to video memory if the terminal is active, leaves the cursor alone
+ */
+static void render_chars(uint8_t terminal_index, const char *buffer, int32_t count, uint8_t attribute){
+    terminal_t * terminal = &terminals[terminal_index];
+    uint8_t * cell;
+    int32_t i, x, y, lines;
+
+    //Find the line the run ends on, as if the screen were endless
+    x = terminal->pos_x;
+    y = terminal->pos_y;
+    for(i = 0; i < count; i++){
+        if(buffer[i] == '\n' || buffer[i] == '\r' || ++x >= NUM_COLS){
+            x = 0;
+            y++;
+        }
+    }
+    lines = y - (NUM_ROWS - 1);
+    if(lines > 0)
+        scroll_terminal(terminal_index, lines);
+    else
+        lines = 0;
+
+    //Draw with every position moved up by the scroll, rows above the screen are history lines
+    x = terminal->pos_x;
+    y = terminal->pos_y - lines;
+    for(i = 0; i < count; i++){
+        if(buffer[i] == '\n' || buffer[i] == '\r'){ //handle newline input
+            x = 0;
+            y++;
+            continue;
+        }
+        if(y >= 0)
+            cell = terminal->video_start + ((NUM_COLS * y + x) << 1);
+        else if(terminal->scrollback != NULL && -y <= SCROLLBACK_LINES)
+            cell = history_line(terminal, -y) + (x << 1);
+        else
+            cell = NULL;        //Scrolled out of the history too
+        if(cell != NULL){
+            cell[0] = buffer[i];
+            cell[1] = attribute;
+        }
+        //If horizontal overflow, reset to next line
+        if(++x >= NUM_COLS){
+            x = 0;
+            y++;
+        }
+    }
+    terminal->pos_x = x;
+    terminal->pos_y = y;
 }
 
 /*
@@ -101,86 +260,39 @@ void clear_terminal(uint8_t terminal_index){
  *   SIDE EFFECTS: writes to video memory, modifies terminal
  */
 void terminal_putc(char input, uint8_t attribute, uint8_t terminal_index){
-  //This code mostly comes from the old lib.c putc method, with some modifications
-  if(input == '\n' || input == '\r') { //handle newline input
-      terminals[terminal_index].pos_y++;
-      terminals[terminal_index].pos_x = 0;
-  } else {
-      //write character to the memory of the associated terminal
-      *(uint8_t *)(terminals[terminal_index].video_start + ((NUM_COLS * terminals[terminal_index].pos_y + terminals[terminal_index].pos_x) << 1)) = input;
-      *(uint8_t *)(terminals[terminal_index].video_start + ((NUM_COLS * terminals[terminal_index].pos_y + terminals[terminal_index].pos_x) << 1) + 1) = attribute;
-      terminals[terminal_index].pos_x++;
-
-      //If horizontal overflow, reset to next line
-      if(terminals[terminal_index].pos_x >= NUM_COLS){
-        terminals[terminal_index].pos_y++;
-        terminals[terminal_index].pos_x = 0;
-      }
-  }
-
-  //Take care of scrolling screen up
-  if(terminals[terminal_index].pos_y >= NUM_ROWS){
-      int i; //loop counter
-      for(i = 0; i < NUM_COLS * (NUM_ROWS-1); i++){
-          *(uint8_t *)(terminals[terminal_index].video_start + (i << 1)) = *(uint8_t *)(terminals[terminal_index].video_start + ((i + NUM_COLS) << 1));
-          *(uint8_t *)(terminals[terminal_index].video_start + (i << 1) + 1) = *(uint8_t *)(terminals[terminal_index].video_start + ((i + NUM_COLS) << 1) + 1);
-      }
-      //Clear last row
-      for(i = i; i < NUM_COLS * NUM_ROWS; i++){
-        *(uint8_t *)(terminals[terminal_index].video_start + (i << 1)) = ' ';
-        *(uint8_t *)(terminals[terminal_index].video_start + (i << 1) + 1) = ATTRIB;
-      }
-      terminals[terminal_index].pos_y = NUM_ROWS - 1;
-  }
+  render_chars(terminal_index, &input, 1, attribute);
 
   //At this point, update the location of the cursor
-  //TODO only do this if the terminal is active
-  if(terminal_index == active_terminal_index)
-      move_cursor(terminals[terminal_index].pos_x, terminals[terminal_index].pos_y);
+  update_cursor(terminal_index);
 }
 
 /*
  * terminal_read
- *   DESCRIPTION: Reads from the terminal input buffer and copies into a userspace buffer
+ *   DESCRIPTION: Reads from the terminal's input ring and copies into a userspace buffer.
+ *                In canonical mode a read returns at most one line, in raw mode whatever
+ *                keys are waiting. Either way it blocks until there is something to return
  *   INPUTS:
  *     - uint8_t *buffer: the userspace buffer to copy into
  *     - uint32_t num_bytes: The maximum number of bytes to copy into the buffer
- *     - terminal_t *terminal: The terminal to copy from
  *   OUTPUTS: none
  *   RETURN VALUE: the number of bytes copied into the buffer
- *   SIDE EFFECTS: modifes terminal input buffer and userspace buffer
+ *   SIDE EFFECTS: takes the bytes out of the input ring
  */
 int32_t terminal_read(int32_t fd, char *buffer, int32_t num_bytes){
-    pcb_t * pcb = getCurrentProcessPCB();
+    terminal_t * terminal = &terminals[getCurrentProcessPCB()->terminal_index];
     if(fd == 1) return -1;    //Invalid read from stdout
 
-    if(buffer == NULL) return -1;
+    if(buffer == NULL || num_bytes < 0) return -1;
     uint32_t flags;
-    if(num_bytes > TERMINAL_BUFFER_SIZE) num_bytes = TERMINAL_BUFFER_SIZE;
-
-    //It is possible that the number of bytes requested does not have a newline in it
-    //This handles that case
-    //TODO: fix possibility that a newline is pressed before read called and it isn't seen
-    sti();
-    while(terminals[pcb->terminal_index].chars_in_buffer < num_bytes){
-        if(terminals[pcb->terminal_index].buffer[terminals[pcb->terminal_index].chars_in_buffer - 1] == '\n') //If a newline, return now
-            break;
-    }
-    cli_and_save(flags);  //Critical section - no backspaces
-    uint32_t retval = terminals[pcb->terminal_index].chars_in_buffer;
-    //Check if should return fewer characters
-    if(num_bytes < retval) retval = num_bytes;
-
-    //Remove from input buffer
-    terminals[pcb->terminal_index].chars_in_buffer -= retval;
-    uint32_t i; //loop counter
-    for(i = 0; i < retval; i++)
-        buffer[i] = terminals[pcb->terminal_index].buffer[i];
-    uint32_t index = retval;
-    for(i = 0; index < TERMINAL_BUFFER_SIZE; index++){
-        terminals[pcb->terminal_index].buffer[i++] = terminals[pcb->terminal_index].buffer[index];
-    }
+    int32_t retval;
+
+    //Lines typed ahead stay in the ring until someone reads them, so there is nothing to miss
+    cli_and_save(flags);  //No missed wake ups, and readers sharing the terminal don't split a line
+    while(ring_count(&terminal->input) == 0)
+        sleep_on(&terminal->read_wait);  //handle_keypress wakes us when input lands in the ring
 
+    retval = ring_get(&terminal->input, (uint8_t *) buffer, num_bytes,
+                      (terminal->mode == TERMINAL_MODE_CANONICAL) ? '\n' : -1);
     restore_flags(flags); //end critical section
 
     return retval;
@@ -201,16 +313,56 @@ int32_t terminal_write(int32_t fd, const char *buffer, int32_t characters){
   if(fd == 0) return -1;  //Trying to write to stdin
 
   if(buffer == NULL) return -1;
+  if(characters < 0) return -1;
   uint32_t flags;
+  uint8_t terminal_index = getCurrentProcessPCB()->terminal_index;
   cli_and_save(flags); //Pause interrupts so string is written all at once
-  register int32_t index = 0;
-  //Loop through string printing each character one at a time
-  while (/*buffer[index] != '\0' &&*/ index < characters) {  //Assume user knows how many characters they want to write
-      terminal_putc(buffer[index], ATTRIB, getCurrentProcessPCB()->terminal_index);
-      index++;
-  }
+  //Draw the whole buffer at once, assume user knows how many characters they want to write
+  render_chars(terminal_index, buffer, characters, ATTRIB);
+  //One cursor update (four port writes) for the whole write instead of one per character
+  update_cursor(terminal_index);
   restore_flags(flags);   //restore previous interrupt state
-  return index;           //return the number of characters written (may be less than passed size)
+  return characters;      //return the number of characters written
+}
+
+/*
+ * terminal_set_mode
+ *   DESCRIPTION: Switches a terminal between canonical and raw input. A line half typed
+ *                in canonical mode is dropped, input already in the ring stays
+ *   INPUTS: terminal_index - the terminal; mode - TERMINAL_MODE_CANONICAL or TERMINAL_MODE_RAW
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 on a bad mode
+ *   SIDE EFFECTS: modifies the terminal
+ */
+int32_t terminal_set_mode(uint8_t terminal_index, int32_t mode){
+    uint32_t flags;
+
+    if(mode != TERMINAL_MODE_CANONICAL && mode != TERMINAL_MODE_RAW)
+        return -1;
+    cli_and_save(flags);    //The keyboard interrupt looks at the mode and the line
+    terminals[terminal_index].mode = mode;
+    terminals[terminal_index].line_length = 0;
+    restore_flags(flags);
+    return 0;
+}
+
+/*
+ * terminal_ioctl
+ *   DESCRIPTION: Gets or sets the line discipline of the caller's terminal
+ *   INPUTS: fd - ignored, every terminal descriptor is the process's own terminal
+ *           request - TERMINAL_GET_MODE or TERMINAL_SET_MODE; arg - the mode to set
+ *   OUTPUTS: none
+ *   RETURN VALUE: the mode for TERMINAL_GET_MODE, 0 for TERMINAL_SET_MODE, -1 on a bad request or mode
+ *   SIDE EFFECTS: may modify the terminal
+ */
+int32_t terminal_ioctl(int32_t fd, int32_t request, int32_t arg){
+    uint8_t terminal_index = getCurrentProcessPCB()->terminal_index;
+
+    if(request == TERMINAL_GET_MODE)
+        return terminals[terminal_index].mode;
+    if(request == TERMINAL_SET_MODE)
+        return terminal_set_mode(terminal_index, arg);
+    return -1;
 }
 
 /*
@@ -285,12 +437,28 @@ void handle_keypress(void) {
         else if (next_scancode == 0x38) modifiers[R_ALT_INDEX]  = 1;
         else if (next_scancode == 0x9D) modifiers[R_CTRL_INDEX] = 0;
         else if (next_scancode == 0xB8) modifiers[R_ALT_INDEX]  = 0;
+        else if (next_scancode == 0x49 || next_scancode == 0x51)
+            scancode = next_scancode;   //PgUp and PgDn send the keypad's scancode after the prefix
     }
+    //Shift+PgUp and Shift+PgDn browse the scrollback, any other key goes back to the live screen
+    if((scancode == 0x49 || scancode == 0x51) && (modifiers[L_SHIFT_INDEX] || modifiers[R_SHIFT_INDEX])){
+        scroll_view((scancode == 0x49) ? SCROLLBACK_STEP : -SCROLLBACK_STEP);
+        return;
+    }
+    if(terminals[active_terminal_index].view_offset != 0 && scancode < 0x80 && scancode != 0x1D &&
+       scancode != 0x2A && scancode != 0x36 && scancode != 0x38 && scancode != 0x3A)
+        scroll_view(-terminals[active_terminal_index].view_offset);    //Key pressed, and not a modifier
     //This scancode represents backspace
     //TODO: fix when needing to virtualize terminals
     if(scancode == 0x0E){
-        if(terminals[active_terminal_index].chars_in_buffer == 0) return; //Nothing in buffer, so don't backspace
-        terminals[active_terminal_index].buffer[--(terminals[active_terminal_index].chars_in_buffer)] = '\0'; //remove last element from buffer
+        if(terminals[active_terminal_index].mode == TERMINAL_MODE_RAW){
+            pressed = '\b';  //Raw readers get the key itself and do their own editing
+            if(ring_put(&terminals[active_terminal_index].input, (uint8_t *) &pressed, 1) == 1)
+                wake_up(&terminals[active_terminal_index].read_wait);
+            return;
+        }
+        if(terminals[active_terminal_index].line_length == 0) return; //Nothing in the line, so don't backspace
+        terminals[active_terminal_index].line[--(terminals[active_terminal_index].line_length)] = '\0'; //remove last element from the line
         //These next lines take care of setting the position correctly
         if(terminals[active_terminal_index].pos_x == 0){
             if(terminals[active_terminal_index].pos_y == 0) return; //If screen is clear, don't bother moving anything
@@ -304,7 +472,19 @@ void handle_keypress(void) {
         *(uint8_t *)(terminals[active_terminal_index].video_start + ((NUM_COLS * terminals[active_terminal_index].pos_y + terminals[active_terminal_index].pos_x) << 1) + 1) = ATTRIB;
 
         //Update the cursor position with the new position
-        move_cursor(terminals[active_terminal_index].pos_x, terminals[active_terminal_index].pos_y);
+        update_cursor(active_terminal_index);
+    }
+
+    //Alt+F1 through Alt+F12 switch terminals. F1-F10 are 0x3B-0x44, F11 and F12 come later at 0x57-0x58
+    if(modifiers[L_ALT_INDEX] || modifiers[R_ALT_INDEX]){
+        if(scancode >= 0x3B && scancode <= 0x44){
+            switch_terminal(scancode - 0x3B);
+            return;
+        }
+        if(scancode == 0x57 || scancode == 0x58){
+            switch_terminal(scancode - 0x57 + 10);
+            return;
+        }
     }
 
     if(scancode > 0x3F) return; //Scancode not valid for anything else
@@ -323,138 +503,234 @@ void handle_keypress(void) {
         clear_terminal(active_terminal_index);
         return;
     }
-    if(modifiers[L_ALT_INDEX] || modifiers[R_ALT_INDEX]){
-        if(scancode == 0x3B) switch_terminal(0);
-        else if(scancode == 0x3C) switch_terminal(1);
-        else if(scancode == 0x3D) switch_terminal(2);
-    }
-
     if(pressed == 0) return; //Invalid scancode, do nothing
 
     if(modifiers[L_ALT_INDEX] || modifiers[R_ALT_INDEX] || modifiers[L_CTRL_INDEX] || modifiers[R_CTRL_INDEX])
         return;     //Do nothing if modifier keys are pressed, but possible handle later on
 
-    //This code handles putting the keypress in the buffer if there is room for it, or ignores it otherwise
-    //TODO: lookup active terminal
-    if(terminals[active_terminal_index].chars_in_buffer < (TERMINAL_BUFFER_SIZE-1) ||
-          (pressed == '\n' && terminals[active_terminal_index].chars_in_buffer < TERMINAL_BUFFER_SIZE))
-    {
+    terminal_t * terminal = &terminals[active_terminal_index];
+
+    //Raw mode hands every key straight to readers, unechoed. Dropped if nobody is reading and the ring is full
+    if(terminal->mode == TERMINAL_MODE_RAW){
+        if(ring_put(&terminal->input, (uint8_t *) &pressed, 1) == 1)
+            wake_up(&terminal->read_wait);
+        return;
+    }
+
+    //Canonical mode: enter moves the whole line, newline included, into the ring for terminal_read.
+    //If the ring can't take it yet the enter is ignored and the line stays editable
+    if(pressed == '\n'){
+        terminal->line[terminal->line_length] = '\n';
+        if(ring_space(&terminal->input) >= terminal->line_length + 1U){
+            ring_put(&terminal->input, (uint8_t *) terminal->line, terminal->line_length + 1);
+            terminal->line_length = 0;
+            terminal_putc(pressed, ATTRIB, active_terminal_index);
+            wake_up(&terminal->read_wait);
+        }
+        return;
+    }
+
+    //Anything else goes on the line if there is room for it (and the newline after it), or is ignored otherwise
+    if(terminal->line_length < TERMINAL_BUFFER_SIZE - 1){
         terminal_putc(pressed, ATTRIB, active_terminal_index);
-        terminals[active_terminal_index].buffer[terminals[active_terminal_index].chars_in_buffer] = pressed;
-        terminals[active_terminal_index].chars_in_buffer++;
+        terminal->line[terminal->line_length++] = pressed;
+    }
+}
+
+/*
+ * scroll_view
+ *   DESCRIPTION: moves the active terminal's view through its scrollback. The view
+ *                is drawn into its own page of video memory from the history ring and
+ *                the terminal's screen, and displayed instead of the screen, which output
+ *                keeps going to out of sight. Coming back to offset 0 displays the screen again
+ *   INPUTS: lines - how many lines to move back, negative to move forward
+ *   OUTPUTS: writes the view to video memory
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: changes the page displayed, hides the cursor while browsing
+ */
+static void scroll_view(int32_t lines){
+    terminal_t * terminal = &terminals[active_terminal_index];
+    int32_t offset = terminal->view_offset + lines;
+    int32_t row, line;
+    uint8_t * source, * view;
+    uint32_t flags;
+
+    if(offset > terminal->scrollback_count)
+        offset = terminal->scrollback_count;
+    if(offset < 0)
+        offset = 0;
+    if(offset == terminal->view_offset)
+        return;    //Already as far as it goes
+
+    cli_and_save(flags);
+    terminal->view_offset = offset;
+    if(offset == 0){
+        set_display_page(terminal->vga_page);
+        update_cursor(active_terminal_index);
+        restore_flags(flags);
+        return;
+    }
+
+    //Row 0 of the view is offset lines above the top of the live screen
+    view = (uint8_t *) (VIDEO_BASE + SCROLLBACK_VIEW_PAGE * KB_4);
+    for(row = 0; row < NUM_ROWS; row++){
+        line = row - offset;
+        if(line >= 0)
+            source = terminal->video_start + ((NUM_COLS * line) << 1);
+        else
+            source = history_line(terminal, -line);
+        memcpy(view + ((NUM_COLS * row) << 1), source, NUM_COLS << 1);
+    }
+    set_display_page(SCROLLBACK_VIEW_PAGE);
+    move_cursor(0, NUM_ROWS);    //Just past the last row, off the screen
+    restore_flags(flags);
+}
+
+/*
+ * add_video_mapper
+ *   DESCRIPTION: puts a process that has vidmapped its terminal's screen on the terminal's
+ *                list, so its mapping is moved along with the screen
+ *   INPUTS: pid - the process, its video_page_table must be set
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the terminal and the PCB
+ */
+void add_video_mapper(uint32_t pid){
+    pcb_t * pcb = getProcessPCB(pid);
+    terminal_t * terminal = &terminals[pcb->terminal_index];
+
+    pcb->next_video_mapper = terminal->video_mappers;
+    terminal->video_mappers = pid;
+}
+
+/*
+ * remove_video_mapper
+ *   DESCRIPTION: takes a process off its terminal's list of vidmap users
+ *   INPUTS: pid - the process
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the terminal and the PCB
+ */
+void remove_video_mapper(uint32_t pid){
+    pcb_t * pcb = getProcessPCB(pid);
+    uint32_t * link = &terminals[pcb->terminal_index].video_mappers;
+
+    while(*link != 0 && *link != pid)
+        link = &getProcessPCB(*link)->next_video_mapper;
+    if(*link == pid)
+        *link = pcb->next_video_mapper;
+    pcb->video_page_table = NULL;
+}
+
+/*
+ * move_screen
+ *   DESCRIPTION: points a terminal, and the vidmap page of every process on its list,
+ *                at a new home for its screen. Only this terminal's processes are looked at
+ *   INPUTS: terminal - the terminal; screen - where its screen is now
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies page tables, the caller flushes the TLB
+ */
+static void move_screen(terminal_t * terminal, uint8_t * screen){
+    uint32_t pid;
+    pcb_t * pcb;
+
+    terminal->video_start = screen;
+    for(pid = terminal->video_mappers; pid != 0; pid = pcb->next_video_mapper){
+        pcb = getProcessPCB(pid);
+        pcb->video_page_table[0] = (pcb->video_page_table[0] & 0x00000FFF) | (uint32_t) screen;
     }
 }
 
+/*
+ * load_screen
+ *   DESCRIPTION: gives a terminal a page of video memory for its screen. A free page is
+ *                used if there is one, otherwise the terminal in the background that was
+ *                shown least recently moves its screen out to its storage page. A terminal
+ *                shown for the first time gets a blank screen and its scrollback history
+ *   INPUTS: terminal_index - the terminal, which must not have a page already
+ *   OUTPUTS: none
+ *   RETURN VALUE: 0 on success, -1 if there was no memory for a storage page
+ *   SIDE EFFECTS: may allocate memory, copies screens, remaps vidmap pages and flushes the TLB
+ */
+static int32_t load_screen(uint8_t terminal_index){
+    terminal_t * terminal = &terminals[terminal_index];
+    terminal_t * victim;
+    uint8_t * screen;
+    int32_t i, owner, page = -1;
+
+    for(i = 0; i < NUM_TERMINAL_PAGES; i++){
+        owner = page_owner[i];
+        if(owner == -1){
+            page = i;
+            break;
+        }
+        if(owner != active_terminal_index &&
+           (page == -1 || terminals[owner].last_shown < terminals[(uint8_t) page_owner[page]].last_shown))
+            page = i;
+    }
+    screen = (uint8_t *) (VIDEO_BASE + page * KB_4);
+
+    owner = page_owner[page];
+    if(owner != -1){
+        victim = &terminals[owner];
+        if(victim->storage_location == NULL){
+            //Kept once allocated, the terminal is likely to lose its page again
+            victim->storage_location = (uint8_t *) alloc_pages(ALLOC_KERNEL, 0);
+            if(victim->storage_location == NULL)
+                return -1;
+        }
+        memcpy(victim->storage_location, screen, KB_4);
+        move_screen(victim, victim->storage_location);
+        victim->vga_page = -1;
+    }
+
+    if(terminal->video_start == NULL){
+        memset_word(screen, (ATTRIB << 8) | ' ', VGA_PAGE_CELLS);
+        terminal->scrollback = kmalloc((SCROLLBACK_LINES * NUM_COLS) << 1);
+    }
+    else
+        memcpy(screen, terminal->video_start, KB_4);
+    move_screen(terminal, screen);
+    terminal->vga_page = page;
+    page_owner[page] = terminal_index;
+    flush_tlb();    //May be running as the idle task, so just reload whatever directory is loaded
+    return 0;
+}
+
 /*
  * void switch_terminal(uint8_t next_terminal_index)
  *   DESCRIPTION: Switches active terminal from one to another
  *   INPUTS: next_terminal_index - the terminal to switch to
- *   OUTPUTS: Writes a new screen to memory
+ *   OUTPUTS: Displays the other terminal's screen
  *   RETURN VALUE: none
- *   SIDE EFFECTS: Can schedule a new terminal for creation, if necessary; Writes to video memory
+ *   SIDE EFFECTS: Can schedule a new terminal for creation, if necessary; Changes the page displayed
  */
 void switch_terminal(uint8_t next_terminal_index){
-    uint32_t i, process_id, entry, flags;
+    uint32_t flags;
 
-    if(next_terminal_index > 2 || next_terminal_index == active_terminal_index)
+    if(next_terminal_index >= NUM_TERMINALS || next_terminal_index == active_terminal_index)
         return;    //Invalid terminal to swtich to, do nothing
 
     cli_and_save(flags);
 
-    //Check if the other terminal has something running on it
-    if(terminals[next_terminal_index].active_process != -1){
-        //Something is already running, update active terminal and return
-        //Copy memory from one terminal to another
-        memcpy(terminals[active_terminal_index].storage_location, terminals[active_terminal_index].video_start, KB_4);
-        memcpy((uint8_t *)VIDEO_BASE, terminals[next_terminal_index].storage_location, KB_4);
-        move_cursor(terminals[next_terminal_index].pos_x, terminals[next_terminal_index].pos_y);
-        terminals[active_terminal_index].video_start = terminals[active_terminal_index].storage_location;
-        terminals[next_terminal_index].video_start = (uint8_t *) VIDEO_BASE;
-
-        for(i = 0; i < NUM_MAX_PROCESSES; i++){
-            if((video_mem_page_table[i][0] & 0x07) == 7){
-                //Need to remap this page
-                if((video_mem_page_table[i][0] & 0xFFFFF000) == (uint32_t)VIDEO_BASE){
-                    entry = video_mem_page_table[i][0] & 0x00000FFF;
-                    entry |= (uint32_t)terminals[active_terminal_index].storage_location;
-                    video_mem_page_table[i][0] = entry;
-                }
-                else if((video_mem_page_table[i][0] & 0xFFFFF000) == (uint32_t)terminals[next_terminal_index].storage_location){
-                    entry = video_mem_page_table[i][0] & 0x00000FFF;
-                    entry |= (uint32_t)VIDEO_BASE;
-                    video_mem_page_table[i][0] = entry;
-                }
-            }
-        }
-        loadPageDirectory(page_directory_array[curr_process - 1]);
-
-        active_terminal_index = next_terminal_index;
+    //Most of the time the screen is still in video memory, and nothing is copied or remapped
+    if(terminals[next_terminal_index].vga_page == -1 && load_screen(next_terminal_index) == -1){
         restore_flags(flags);
-        return;
+        return;    //No memory to move another screen out of the way
     }
 
-    //Try to find an open process
-    for(process_id = 0; process_id < NUM_MAX_PROCESSES; process_id++){
-        if(active[process_id] == INACTIVE) break;
+    //If nothing is running on the other terminal yet, start a shell there for the scheduler to pick up
+    if(terminals[next_terminal_index].active_process == -1 && launch_shell(next_terminal_index) == -1){
+        restore_flags(flags);
+        return;    //No open processes, do nothing
     }
 
-    if(process_id >= NUM_MAX_PROCESSES) return; //No open processes, do nothing
-
-    process_id++;    //1-index PID to be consistent
-
-    //Copy memory from one terminal to another
-    memcpy(terminals[active_terminal_index].storage_location, terminals[active_terminal_index].video_start, KB_4);
-    memcpy((uint8_t *)VIDEO_BASE, terminals[next_terminal_index].storage_location, KB_4);
-    move_cursor(terminals[next_terminal_index].pos_x, terminals[next_terminal_index].pos_y);
-    terminals[active_terminal_index].video_start = terminals[active_terminal_index].storage_location;
-    terminals[next_terminal_index].video_start = (uint8_t *) VIDEO_BASE;
-
-    for(i = 0; i < NUM_MAX_PROCESSES; i++){
-        if((video_mem_page_table[i][0] & 0x07) == 7){
-            //Need to remap this page
-            if((video_mem_page_table[i][0] & 0xFFFFF000) == (uint32_t)VIDEO_BASE){
-                entry = video_mem_page_table[i][0] & 0x00000FFF;
-                entry |= (uint32_t)terminals[active_terminal_index].storage_location;
-                video_mem_page_table[i][0] = entry;
-            }
-            else if((video_mem_page_table[i][0] & 0xFFFFF000) == (uint32_t)terminals[next_terminal_index].storage_location){
-                entry = video_mem_page_table[i][0] & 0x00000FFF;
-                entry |= (uint32_t)VIDEO_BASE;
-                video_mem_page_table[i][0] = entry;
-            }
-        }
-    }
-    loadPageDirectory(page_directory_array[curr_process - 1]);
-
-    pcb_t * shell = getProcessPCB(process_id);
-    shell->arg[0] = 0;
-    shell->num_char_in_arg = 1;
-    shell->parent_num = 0;
-    shell->terminal_index = next_terminal_index;
-    shell->parent_esp = 0;
-    shell->parent_ebp = 0;
-    shell->exec_ret_addr = 0;
-
-    active[process_id - 1] = ACTIVE;
-
-    //Write the shell to memory
-    loadPageDirectory(page_directory_array[process_id - 1]);
-    load_program((uint8_t *)"shell", (uint8_t *)V_PROGRAM_BASE);
-
-    init_file_array(shell->file_array);
-    shell->current_eip = 0;
-    shell->current_eip |= ((uint8_t *)V_PROGRAM_BASE)[24];
-    shell->current_eip |= ((uint8_t *)V_PROGRAM_BASE)[25] << 8;
-    shell->current_eip |= ((uint8_t *)V_PROGRAM_BASE)[26] << 16;
-    shell->current_eip |= ((uint8_t *)V_PROGRAM_BASE)[27] << 24;
-    shell->current_ebp = 0;
-    shell->current_esp = MB_128 + MB_4 - B_4;
-    shell->is_user_mode = 1;
-
-    loadPageDirectory(page_directory_array[curr_process - 1]);
-
-    //Mark the terminal as having an active program on it
-    terminals[next_terminal_index].active_process = process_id;
+    //The VGA just displays another page
+    terminals[active_terminal_index].view_offset = 0;    //Leaving the scrollback view, if it was up
     active_terminal_index = next_terminal_index;
+    terminals[next_terminal_index].last_shown = ++switch_count;
+    set_display_page(terminals[next_terminal_index].vga_page);
+    update_cursor(next_terminal_index);
     restore_flags(flags);
 }
@@ -7,13 +7,29 @@
 #include "lib.h"
 #include "interrupt_handler.h"
 #include "syscalls.h"
+#include "wait_queue.h"
+#include "ring_buffer.h"
 
-#define NUM_TERMINALS 3
+#define NUM_TERMINALS 12
 
-//These are the out-of-video-memory storage addresses for terminals
-#define terminal0_storage 0xB9000
-#define terminal1_storage 0xBA000
-#define terminal2_storage 0xBB000
+//Lines of history each terminal keeps above its screen, and how far Shift+PgUp/PgDn move through them
+#define SCROLLBACK_LINES 200
+#define SCROLLBACK_STEP  (NUM_ROWS / 2)
+
+//Line disciplines. Canonical echoes keys, lets backspace edit the line and hands whole
+//lines to terminal_read when enter is pressed. Raw hands over every key at once, unechoed
+#define TERMINAL_MODE_CANONICAL 0
+#define TERMINAL_MODE_RAW       1
+
+//ioctl requests a terminal understands
+#define TERMINAL_GET_MODE 0
+#define TERMINAL_SET_MODE 1
+
+//Terminals draw into a page of video memory while they have one, so switching between them just changes
+//the page displayed. There are more terminals than pages: when one needs a page, the terminal shown least
+//recently moves its screen out to a storage page from the allocator. The scrollback view is drawn into the last page
+#define NUM_TERMINAL_PAGES   (VGA_PAGES - 1)
+#define SCROLLBACK_VIEW_PAGE (VGA_PAGES - 1)
 
 //This is the curerntly active terminal index
 uint8_t active_terminal_index;
@@ -30,13 +46,23 @@ extern const char CAPSLOCK_SCANCODES[];
  * This struct should hopefully make that easier.
  */
 typedef struct terminal_t{
-    char buffer[TERMINAL_BUFFER_SIZE];
-    uint8_t* video_start;
-    uint8_t* storage_location;
+    char line[TERMINAL_BUFFER_SIZE];    //The line being typed in canonical mode, not readable until enter
+    uint8_t* video_start;               //The terminal's screen, in video memory or storage. NULL until it is first shown
+    uint8_t* storage_location;          //Where the screen goes when its page of video memory is taken, NULL until then
+    int8_t   vga_page;                  //The page of video memory holding the screen, -1 if it is in storage
+    uint32_t last_shown;                //When the terminal was last switched to, to pick which screen gives up its page
+    uint32_t video_mappers;             //1-indexed PID of the first process that vidmapped the screen, 0 if none
     uint16_t pos_x;
     uint16_t pos_y;
-    uint16_t chars_in_buffer;
+    uint16_t line_length;
+    uint8_t  mode;
     int8_t   active_process;
+    ring_buffer_t input;        //Input ready for terminal_read, the keyboard interrupt is the only producer
+    wait_queue_t read_wait;     //Processes sleeping in terminal_read until input arrives
+    uint16_t* scrollback;       //SCROLLBACK_LINES lines of NUM_COLS cells used as a ring, NULL if there was no memory
+    uint16_t scrollback_head;   //The slot the next line scrolled off the top goes in
+    uint16_t scrollback_count;  //Lines of history kept so far
+    uint16_t view_offset;       //Lines the view is scrolled back by, 0 when the live screen is shown
 } terminal_t;
 
 terminal_t terminals[NUM_TERMINALS];
@@ -47,12 +73,21 @@ void handle_keypress();
 /* This method initalizes a terminal */
 void init_terminals();
 
+/* This method gives each terminal its scrollback history, once the kernel heap is up */
+void init_scrollback();
+
 /* This method writes a string to a terminal */
 int32_t terminal_write(int32_t fd, const char *buffer, int32_t characters);
 
 /* This method reads from the input buffer to a userspace buffer */
 int32_t terminal_read(int32_t fd, char *buffer, int32_t num_bytes);
 
+/* This method gets or sets the line discipline of the caller's terminal */
+int32_t terminal_ioctl(int32_t fd, int32_t request, int32_t arg);
+
+/* This method sets the line discipline of a terminal */
+int32_t terminal_set_mode(uint8_t terminal_index, int32_t mode);
+
 /* These methods are called by systemcalls, but they do nothing really */
 int32_t terminal_open();
 int32_t terminal_close();
@@ -60,6 +95,10 @@ int32_t terminal_close();
 /* This method writes a single character to a terminal */
 void terminal_putc(char input, uint8_t attribute, uint8_t terminal_index);
 
+/* These methods add a process to, and remove it from, the processes whose vidmap page follows its terminal's screen */
+void add_video_mapper(uint32_t pid);
+void remove_video_mapper(uint32_t pid);
+
 /* This method will zero out a terminal, clearing it */
 void clear_terminal(uint8_t terminal_index);
 
@@ -4,31 +4,92 @@
 /* functions based off of discussion slides */
 /* function headers based off of ece391syscall.h */
 
-static uint8_t * fs_ptr;
-static file_t blank;
-static int32_t terminal_ops[4] = { (int32_t) &terminal_open, (int32_t) &terminal_read, (int32_t) &terminal_write, (int32_t) &terminal_close}; // open, read, write, close
-static int32_t file_ops[4] = { (int32_t) &file_open, (int32_t) &file_read, (int32_t) &file_write, (int32_t) &file_close}; // open, read, write, close
-static int32_t directory_ops[4] = { (int32_t) &directory_open, (int32_t) &directory_read, (int32_t) &directory_write, (int32_t) &directory_close}; // open, read, write, close
-static int32_t rtc_ops[4] = { (int32_t) &rtc_open, (int32_t) &rtc_read, (int32_t) &rtc_write, (int32_t) &rtc_close}; // open, read, write, close
-
-
-/* load_program
- * DESCRIPTION: loads program file into memory
- * INPUTS: name of executable file, pointer to where to copy program in memory
- * OUTPUTS: copies program file contents to memory
- * RETURN VALUE: 0 if success, -1 if fail
+// the boot block stays held in the block cache while the filesystem is mounted
+static buffer_t * boot_buffer;
+static boot_block_t * boot_block;
+// device block number of a data block, data blocks follow the boot block and the inodes
+#define DATA_BLOCK(n) (boot_block->inode_count + 1 + (n))
+
+// hash index over the root directory's entries in the boot block, chained through dentry_hash_next
+static int8_t dentry_hash_head[DENTRY_HASH_SIZE];
+static int8_t dentry_hash_next[NUM_FILES];
+
+// recent lookups in any directory, keyed by (directory inode, name), so walking
+// the same path again never rescans a directory's blocks. Names that weren't
+// found are cached too, with filetype -1. Direct mapped, a new lookup replaces
+// whatever was in its slot
+typedef struct dcache_entry_t{
+  int32_t parent;
+  uint32_t hash;
+  int8_t filename[FILENAME_LEN];
+  int32_t filetype;
+  int32_t inode_num;
+  uint8_t valid;
+} dcache_entry_t;
+static dcache_entry_t dcache[DCACHE_SIZE];
+
+// which inodes and data blocks are in use, a set bit means used. Built at mount
+// time, the image itself doesn't track free space
+static uint32_t * inode_bitmap;
+static uint32_t * block_bitmap;
+
+// per inode extent tables built at mount time, NULL (or a NULL entry) means read_data
+// finds the runs itself from data_block_num
+static extent_table_t * extent_tables;
+
+// per inode read ahead state built at mount time, NULL means read_data never reads ahead
+static read_ahead_t * read_ahead_state;
+
+// open files come from their own slab cache, a process's descriptor table holds pointers into it
+kmem_cache_t file_cache;
+static int32_t no_pread(int32_t fd, int8_t* buf, int32_t nbytes, uint32_t offset);
+static int32_t no_pwrite(int32_t fd, const int8_t* buf, int32_t nbytes, uint32_t offset);
+static int32_t no_getdents(int32_t fd, void* buf, int32_t nbytes);
+static int32_t no_ioctl(int32_t fd, int32_t request, int32_t arg);
+static int32_t dir_entry_count(int32_t dir);
+static int32_t read_dir_entry(int32_t dir, uint32_t index, dentry_t* dentry);
+static int32_t lookup_in_dir(int32_t dir, const int8_t* name, dentry_t* dentry);
+static void dcache_insert(int32_t parent, const int8_t* name, uint32_t hash, const dentry_t* dentry);
+static uint32_t dentry_hash(const int8_t* fname);
+static int32_t is_dot_name(const int8_t* name);
+static int32_t terminal_ops[NUM_FILE_OPS] = { (int32_t) &terminal_open, (int32_t) &terminal_read, (int32_t) &terminal_write, (int32_t) &terminal_close, (int32_t) &no_pread, (int32_t) &no_pwrite, (int32_t) &no_getdents, (int32_t) &terminal_ioctl}; // open, read, write, close, pread, pwrite, getdents, ioctl
+static int32_t file_ops[NUM_FILE_OPS] = { (int32_t) &file_open, (int32_t) &file_read, (int32_t) &file_write, (int32_t) &file_close, (int32_t) &file_pread, (int32_t) &file_pwrite, (int32_t) &no_getdents, (int32_t) &no_ioctl}; // open, read, write, close, pread, pwrite, getdents, ioctl
+static int32_t directory_ops[NUM_FILE_OPS] = { (int32_t) &directory_open, (int32_t) &directory_read, (int32_t) &directory_write, (int32_t) &directory_close, (int32_t) &no_pread, (int32_t) &no_pwrite, (int32_t) &directory_getdents, (int32_t) &no_ioctl}; // open, read, write, close, pread, pwrite, getdents, ioctl
+static int32_t rtc_ops[NUM_FILE_OPS] = { (int32_t) &rtc_open, (int32_t) &rtc_read, (int32_t) &rtc_write, (int32_t) &rtc_close, (int32_t) &no_pread, (int32_t) &no_pwrite, (int32_t) &no_getdents, (int32_t) &no_ioctl}; // open, read, write, close, pread, pwrite, getdents, ioctl
+
+
+/* read_inode
+ * DESCRIPTION: gets an inode's block from the block cache
+ * INPUTS: inode - inode number
+ * OUTPUTS: none
+ * RETURN VALUE: buffer holding the inode, to be given back with brelse.
+ *               NULL if the inode number is out of range or the block can't be read
  * SIDE EFFECTS: none
  */
-int32_t load_program(const uint8_t* filename, uint8_t * ptr)
+static buffer_t* read_inode(uint32_t inode)
+{
+  if (inode >= boot_block->inode_count)
+    return NULL;
+  //inodes follow the boot block
+  return bread(inode + 1);
+}
+
+/* open_program
+ * DESCRIPTION: finds an executable and reads what execute needs from its ELF
+ *              header, without loading it. Pages are read in on demand by
+ *              read_program_page
+ * INPUTS: name of executable file, where to store the image information
+ * OUTPUTS: inode, size and entry point of the program in image
+ * RETURN VALUE: 0 if success, -1 if the file is missing or not an executable
+ * SIDE EFFECTS: none
+ */
+int32_t open_program(const uint8_t* filename, program_image_t* image)
 {
   dentry_t new_dent;
-  uint32_t count = 0;
-  while(filename[count] != NULL)
-  {
-    count++;
-  }
-  //off by 1 possibly; take a look later
-  if (count >= 33)
+  uint8_t header[ELF_HEADER_SIZE];
+  buffer_t* inode_buffer;
+
+  if (strlen((int8_t*) filename) > MAX_PATH_LEN)
     return -1;
   //file with matching file name not found, return -1
   if (read_dentry_by_name(filename, &new_dent) == -1)
@@ -37,27 +98,396 @@ int32_t load_program(const uint8_t* filename, uint8_t * ptr)
   if(new_dent.filetype != 2)
     return -1; //Not a normal file to open
 
-  uint32_t inode = new_dent.inode_num;
-  uint32_t offset = 0;
-  inode_block_t* inode_block = (inode_block_t*) (fs_ptr + NUM_B_IN_FOUR_KB * (inode + 1));
-  uint32_t size = inode_block->length;
-//  int8_t buf[size];
+  // fail if the header is cut short or the file isn't an executable
+  if (read_data(new_dent.inode_num, 0, header, ELF_HEADER_SIZE) != ELF_HEADER_SIZE)
+    return -1;
+  if (header[0] != 0x7F || header[1] != 0x45 || header[2] != 0x4C || header[3] != 0x46) // magic numbers to specify executable file
+    return -1;
+
+  inode_buffer = read_inode(new_dent.inode_num);
+  if (inode_buffer == NULL)
+    return -1;
+  image->inode = new_dent.inode_num;
+  image->size = ((inode_block_t*) inode_buffer->data)->length;
+  brelse(inode_buffer);
+  //entry point - bytes 24-27
+  image->entry = *(uint32_t*) (header + ELF_ENTRY);
+  return 0;
+}
+
+/* file_page_address
+ * DESCRIPTION: finds a page of a file that can be mapped straight from the
+ *              filesystem image instead of copied. That works when the device
+ *              keeps the image in memory, page aligned, and the whole page lies
+ *              inside the file, since every data block is then its own 4KB page
+ * INPUTS: inode and length of the file, page aligned offset in the file
+ * OUTPUTS: none
+ * RETURN VALUE: address of the data block holding the page, NULL if it has to be copied
+ * SIDE EFFECTS: none
+ */
+uint8_t* file_page_address(uint32_t inode, uint32_t size, uint32_t offset)
+{
+  buffer_t* inode_buffer;
+  uint32_t data_block_num;
+  uint8_t* page;
+
+  if (offset + NUM_B_IN_FOUR_KB > size)
+    return NULL;
+
+  inode_buffer = read_inode(inode);
+  if (inode_buffer == NULL)
+    return NULL;
+  data_block_num = ((inode_block_t*) inode_buffer->data)->data_block_num[offset / NUM_B_IN_FOUR_KB];
+  brelse(inode_buffer);
+
+  if (data_block_num >= boot_block->data_count)
+    return NULL;
+  page = block_address(DATA_BLOCK(data_block_num));
+  if (((uint32_t) page & (NUM_B_IN_FOUR_KB - 1)) != 0)
+    return NULL;
+  return page;
+}
+
+/* read_file_page
+ * DESCRIPTION: fills one 4KB page from a file, the part of the page past the
+ *              end of the file is zeroed
+ * INPUTS: inode and length of the file, offset of the page in the file, page to fill
+ * OUTPUTS: copies file contents to the page
+ * RETURN VALUE: 0 if success, -1 if the file could not be read
+ * SIDE EFFECTS: none
+ */
+int32_t read_file_page(uint32_t inode, uint32_t size, uint32_t offset, uint8_t* page)
+{
+  int32_t read = 0;
+
+  if (offset < size){
+    read = read_data(inode, offset, page, NUM_B_IN_FOUR_KB);
+    if (read == -1)
+      return -1;
+  }
+  memset(page + read, 0, NUM_B_IN_FOUR_KB - read);
+  return 0;
+}
+
+/* program_page_address
+ * DESCRIPTION: file_page_address for a page of a program
+ * INPUTS: image from open_program, page aligned offset in the file
+ * OUTPUTS: none
+ * RETURN VALUE: address of the data block holding the page, NULL if it has to be copied
+ * SIDE EFFECTS: none
+ */
+uint8_t* program_page_address(const program_image_t* image, uint32_t offset)
+{
+  return file_page_address(image->inode, image->size, offset);
+}
+
+/* read_program_page
+ * DESCRIPTION: fills one 4KB page of a program from its file, the part of
+ *              the page past the end of the file is zeroed
+ * INPUTS: image from open_program, offset of the page in the file, page to fill
+ * OUTPUTS: copies program file contents to the page
+ * RETURN VALUE: 0 if success, -1 if the file could not be read
+ * SIDE EFFECTS: none
+ */
+int32_t read_program_page(const program_image_t* image, uint32_t offset, uint8_t* page)
+{
+  return read_file_page(image->inode, image->size, offset, page);
+}
+
+/* file_size
+ * DESCRIPTION: finds the length of an open regular file
+ * INPUTS: the open file
+ * OUTPUTS: none
+ * RETURN VALUE: length in bytes, -1 if it is not a regular file
+ * SIDE EFFECTS: none
+ */
+int32_t file_size(file_t* file)
+{
+  buffer_t* inode_buffer;
+  int32_t size;
+
+  if (file == NULL || file->file_ops_table_ptr != (int32_t) file_ops)
+    return -1;
+  inode_buffer = read_inode(file->inode_num);
+  if (inode_buffer == NULL)
+    return -1;
+  size = ((inode_block_t*) inode_buffer->data)->length;
+  brelse(inode_buffer);
+  return size;
+}
+
+/* alloc_bit
+ * DESCRIPTION: takes the first clear bit of a bitmap
+ * INPUTS: bitmap, number of bits in it
+ * OUTPUTS: sets the bit
+ * RETURN VALUE: index of the bit, -1 if all are set
+ * SIDE EFFECTS: none
+ */
+static int32_t alloc_bit(uint32_t* bitmap, uint32_t bits)
+{
+  uint32_t i, flags;
+
+  cli_and_save(flags);
+  for (i = 0; i < bits; i++){
+    if ((bitmap[i / 32] & (1 << (i % 32))) == 0){
+      bitmap[i / 32] |= 1 << (i % 32);
+      restore_flags(flags);
+      return i;
+    }
+  }
+  restore_flags(flags);
+  return -1;
+}
+
+/* alloc_data_block
+ * DESCRIPTION: takes a free data block
+ * INPUTS: none
+ * OUTPUTS: marks it used
+ * RETURN VALUE: data block number, -1 if the filesystem is full
+ * SIDE EFFECTS: none
+ */
+static int32_t alloc_data_block(void)
+{
+  if (block_bitmap == NULL)
+    return -1;
+  return alloc_bit(block_bitmap, boot_block->data_count);
+}
+
+/* free_data_block
+ * DESCRIPTION: gives back a data block from alloc_data_block
+ * INPUTS: data block number
+ * OUTPUTS: marks it free
+ * RETURN VALUE: none
+ * SIDE EFFECTS: none
+ */
+static void free_data_block(int32_t block)
+{
+  if (block_bitmap != NULL && block >= 0 && block < boot_block->data_count)
+    block_bitmap[block / 32] &= ~(1 << (block % 32));
+}
+
+/* mark_directory
+ * DESCRIPTION: marks the inodes and data blocks used by everything in a
+ *              directory, going down into its subdirectories. A directory seen
+ *              before isn't gone into again, so a corrupt image with a loop
+ *              can't recurse forever
+ * INPUTS: dir - inode of the directory, ROOT_DIR_INODE for the root
+ *         depth - how many directories down from the root it is
+ * OUTPUTS: sets bits in inode_bitmap and block_bitmap
+ * RETURN VALUE: none
+ * SIDE EFFECTS: none
+ */
+static void mark_directory(int32_t dir, uint32_t depth)
+{
+  dentry_t dentry;
+  buffer_t* inode_buffer;
+  inode_block_t* inode_block;
+  uint32_t i, j, blocks;
+  int32_t block, dir_count, seen;
+
+  dir_count = dir_entry_count(dir);
+  for (i = 0; (int32_t) i < dir_count; i++){
+    if (read_dir_entry(dir, i, &dentry) == -1)
+      break;
+    if (dentry.inode_num < 0 || dentry.inode_num >= boot_block->inode_count)
+      continue;
+    seen = inode_bitmap[dentry.inode_num / 32] & (1 << (dentry.inode_num % 32));
+    inode_bitmap[dentry.inode_num / 32] |= 1 << (dentry.inode_num % 32);
+    //devices have no blocks, and "." and ".." point back at directories already being marked
+    if (dentry.filetype == 0 || is_dot_name(dentry.filename) || (dentry.filetype == 1 && seen))
+      continue;
+
+    inode_buffer = read_inode(dentry.inode_num);
+    if (inode_buffer == NULL)
+      continue;
+    inode_block = (inode_block_t*) inode_buffer->data;
+    blocks = (inode_block->length + NUM_B_IN_FOUR_KB - 1) / NUM_B_IN_FOUR_KB;
+    for (j = 0; j < blocks && j < MAX_INODE_BLOCKS; j++){
+      block = inode_block->data_block_num[j];
+      if (block >= 0 && block < boot_block->data_count)
+        block_bitmap[block / 32] |= 1 << (block % 32);
+    }
+    brelse(inode_buffer);
+
+    if (dentry.filetype == 1 && depth < MAX_PATH_DEPTH)
+      mark_directory(dentry.inode_num, depth + 1);
+  }
+}
+
+/* build_free_maps
+ * DESCRIPTION: works out which inodes and data blocks are free from the
+ *              directory tree, an inode is used when a directory entry names it
+ *              and a block when a regular file's or a directory's inode lists it
+ * INPUTS: none
+ * OUTPUTS: allocates and fills inode_bitmap and block_bitmap
+ * RETURN VALUE: 0 on success, -1 if out of memory (the filesystem is then read only)
+ * SIDE EFFECTS: none
+ */
+static int32_t build_free_maps(void)
+{
+  inode_bitmap = (uint32_t*) kmalloc((boot_block->inode_count + 31) / 32 * 4);
+  block_bitmap = (uint32_t*) kmalloc((boot_block->data_count + 31) / 32 * 4);
+  if (inode_bitmap == NULL || block_bitmap == NULL){
+    kfree(inode_bitmap);
+    kfree(block_bitmap);
+    inode_bitmap = block_bitmap = NULL;
+    return -1;
+  }
+  memset(inode_bitmap, 0, (boot_block->inode_count + 31) / 32 * 4);
+  memset(block_bitmap, 0, (boot_block->data_count + 31) / 32 * 4);
+
+  mark_directory(ROOT_DIR_INODE, 0);
+  return 0;
+}
+
+/* create_file
+ * DESCRIPTION: adds an empty regular file or directory. The root directory
+ *              keeps its entries in the boot block, any other directory gets
+ *              the new entry appended to its data
+ * INPUTS: path - path of the new file, which must not exist yet
+ *         filetype - 2 for a regular file, 1 for a directory
+ * OUTPUTS: a new directory entry and inode
+ * RETURN VALUE: 0 on success, -1 on a bad path, or if the directory, the
+ *               inodes or the data blocks are full
+ * SIDE EFFECTS: rebuilds the dentry index when the root changes, updates the dcache
+ */
+int32_t create_file(const uint8_t* path, int32_t filetype)
+{
+  uint8_t parent_path[MAX_PATH_LEN + 1];
+  int8_t name[FILENAME_LEN + 1];
+  buffer_t* inode_buffer;
+  dentry_t dentry;
+  const uint8_t* last;
+  int32_t inode, parent, length, i;
+
+  if (path == NULL || (filetype != 1 && filetype != 2) || strlen((int8_t*) path) > MAX_PATH_LEN)
+    return -1;
+  if (inode_bitmap == NULL)
+    return -1;
+
+  //split the path into the directory and the name of the new entry
+  length = strlen((int8_t*) path);
+  while (length > 0 && path[length - 1] == '/')
+    length--;
+  for (i = length; i > 0 && path[i - 1] != '/'; i--);
+  last = path + i;
+  if (length - i == 0 || length - i > FILENAME_LEN)
+    return -1;
+  memcpy(name, last, length - i);
+  name[length - i] = '\0';
+  if (is_dot_name(name))
+    return -1;
+
+  parent = ROOT_DIR_INODE;
+  if (i > 0){
+    memcpy(parent_path, path, i);
+    parent_path[i] = '\0';
+    if (read_dentry_by_name(parent_path, &dentry) == -1 || dentry.filetype != 1)
+      return -1;
+    parent = dentry.inode_num;
+  }
+  if (lookup_in_dir(parent, name, &dentry) == 0)
+    return -1;
+  if (parent == ROOT_DIR_INODE && boot_block->dir_count >= NUM_FILES)
+    return -1;
 
-  if (read_data(inode, offset, ptr, size) != size) // fail if entire executable file was not read
+  inode = alloc_bit(inode_bitmap, boot_block->inode_count);
+  if (inode == -1)
     return -1;
+  inode_buffer = read_inode(inode);
+  if (inode_buffer == NULL){
+    inode_bitmap[inode / 32] &= ~(1 << (inode % 32));
+    return -1;
+  }
+  ((inode_block_t*) inode_buffer->data)->length = 0;
+  bdirty(inode_buffer);
+  brelse(inode_buffer);
+  build_extent_table(inode);
 
-  uint8_t first = ptr[0];
-  uint8_t second = ptr[1];
-  uint8_t third = ptr[2];
-  uint8_t fourth = ptr[3];
+  memset(&dentry, 0, sizeof(dentry_t));
+  strncpy(dentry.filename, name, FILENAME_LEN);
+  dentry.filetype = filetype;
+  dentry.inode_num = inode;
 
-  // if file isn't an executable
-  if ( first != 0x7F || second != 0x45 || third != 0x4C || fourth != 0x46 ) // magic numbers to specify executable file
+  if (parent == ROOT_DIR_INODE){
+    boot_block->direntries[boot_block->dir_count] = dentry;
+    boot_block->dir_count++;
+    bdirty(boot_buffer);
+    build_dentry_index();
+  }
+  else if (write_data(parent, dir_entry_count(parent) * sizeof(dentry_t), (uint8_t*) &dentry, sizeof(dentry_t)) != sizeof(dentry_t)){
+    inode_bitmap[inode / 32] &= ~(1 << (inode % 32));
     return -1;
+  }
+
+  //replaces the miss cached by the lookup above
+  dcache_insert(parent, name, dentry_hash(name), &dentry);
+  return 0;
+}
 
+/* inode_is_mapped
+ * DESCRIPTION: checks whether any process runs a file or has it mmapped, in which
+ *              case file_page_address may have put its data blocks straight into
+ *              that process's page tables
+ * INPUTS: inode number of the file
+ * OUTPUTS: none
+ * RETURN VALUE: 1 if the file is mapped somewhere, 0 if not
+ * SIDE EFFECTS: none
+ */
+static int32_t inode_is_mapped(uint32_t inode)
+{
+  pcb_t* pcb;
+  uint32_t pid, i;
+
+  for (pid = next_active_pid(0); pid != 0; pid = next_active_pid(pid)){
+    pcb = getProcessPCB(pid);
+    if (pcb->state == TASK_ZOMBIE)
+      continue;   //its address space is already gone
+    if (pcb->image.inode == inode)
+      return 1;
+    for (i = 0; i < NUM_MAX_MAPPED_FILES; i++){
+      if (pcb->mapped_files[i].used && pcb->mapped_files[i].inode == inode)
+        return 1;
+    }
+  }
   return 0;
 }
 
+/* truncate_file
+ * DESCRIPTION: empties a regular file, its data blocks become free. Refused while
+ *              the file is running or mmapped, since its blocks may be mapped
+ *              into those processes and would be handed to other files
+ * INPUTS: inode number of the file
+ * OUTPUTS: sets the length to 0
+ * RETURN VALUE: 0 on success, -1 on a bad inode, if the filesystem is read only
+ *               or if the file is mapped
+ * SIDE EFFECTS: none
+ */
+int32_t truncate_file(uint32_t inode)
+{
+  buffer_t* inode_buffer;
+  inode_block_t* inode_block;
+  uint32_t i, blocks;
+
+  if (block_bitmap == NULL || inode_is_mapped(inode))
+    return -1;
+  inode_buffer = read_inode(inode);
+  if (inode_buffer == NULL)
+    return -1;
+  inode_block = (inode_block_t*) inode_buffer->data;
+
+  blocks = (inode_block->length + NUM_B_IN_FOUR_KB - 1) / NUM_B_IN_FOUR_KB;
+  for (i = 0; i < blocks && i < MAX_INODE_BLOCKS; i++)
+    free_data_block(inode_block->data_block_num[i]);
+  inode_block->length = 0;
+  bdirty(inode_buffer);
+  brelse(inode_buffer);
+
+  build_extent_table(inode);
+  if (read_ahead_state != NULL)
+    memset(&read_ahead_state[inode], 0, sizeof(read_ahead_t));
+  return 0;
+}
 
 /* file_open
  * DESCRIPTION: initialize any temporary structures
@@ -68,9 +498,7 @@ int32_t load_program(const uint8_t* filename, uint8_t * ptr)
  */
 int32_t file_open(const uint8_t* filename)
 {
-  file_t * file_array = getCurrentProcessPCB()->file_array;
   dentry_t new_dent;
-  int32_t index;
   uint32_t count = 0;
 
   if (filename == NULL){
@@ -81,48 +509,64 @@ int32_t file_open(const uint8_t* filename)
   {
     count++;
   }
-  if (count >= 33)
+  if (count > MAX_PATH_LEN)
     return -1;
   //file with matching file name not found, return -1
   if (read_dentry_by_name(filename, &new_dent) == -1)
     return -1;
 
-  // find next available opening in file_array. skip 0 and 1 because taken by stdin and stdout
-  for (index = 2; index < NUM_MAX_OPEN_FILES; index++) // start at 2 b/c first two are reserved
-  {
-    if (file_array[index].flags == FILE_AVAIL) // using flag value to determine if free space in file_array
-      break;
-  }
+  return open_dentry(&new_dent);
+}
+
+/* open_dentry
+ * DESCRIPTION: opens a file that has already been looked up, so callers that
+ *              needed the dentry anyway do not search the directory again
+ * INPUTS: directory entry of the file
+ * OUTPUTS: populates a free entry of the current process's descriptor table
+ * RETURN VALUE: int fd on success, int -1 on failure
+ * SIDE EFFECTS: allocates an open file
+ */
+int32_t open_dentry(const dentry_t* dentry)
+{
+  file_t * file;
+  int32_t index;
+
+  if (dentry->filetype < 0 || dentry->filetype > 2) // unknown file type, return -1 for failure
+    return -1;
+
+  file = (file_t *) kmem_cache_alloc(&file_cache);
+  if (file == NULL)
+    return -1;
 
-  //check if file array is already filled
-  if (index >= NUM_MAX_OPEN_FILES)
-    return -1; // fail b/c no free space in file array
+  // certain values same for all files when init
+  file->inode_num = dentry->inode_num;
+  file->file_position = 0;
+  file->flags = FILE_OCCUP;
+  file->refcount = 1;
 
-  if (new_dent.filetype == 2) // regular file
+  if (dentry->filetype == 2) // regular file
   {
-    file_array[index].file_ops_table_ptr = (int32_t) file_ops;
-    file_array[index].inode_num = new_dent.inode_num;
+    file->file_ops_table_ptr = (int32_t) file_ops;
   }
-  else if (new_dent.filetype == 1) // directory
+  else if (dentry->filetype == 1) // directory
   {
-    file_array[index].file_ops_table_ptr = (int32_t) directory_ops;
-    file_array[index].inode_num = new_dent.inode_num;
+    file->file_ops_table_ptr = (int32_t) directory_ops;
   }
-  else if (new_dent.filetype == 0) // RTC
+  else // RTC
   {
-    file_array[index].file_ops_table_ptr = (int32_t) rtc_ops;
-    file_array[index].inode_num = new_dent.inode_num;
-    rtc_open(index);
-    return index;
+    file->file_ops_table_ptr = (int32_t) rtc_ops;
   }
-  else // unknown file type, return -1 for failure
+
+  // take the lowest free descriptor, stdin and stdout always hold 0 and 1
+  index = install_file(file);
+  if (index == -1)
   {
-    return -1;
+    kmem_cache_free(&file_cache, file);
+    return -1; // fail b/c no free descriptor
   }
 
-  // certain values same for all files when init
-  file_array[index].file_position = 0;
-  file_array[index].flags = FILE_OCCUP;
+  if (dentry->filetype == 0)
+    rtc_open(index);
 
   return index;
 }
@@ -136,14 +580,14 @@ int32_t file_open(const uint8_t* filename)
  */
 int32_t file_close(int32_t fd)
 {
-  file_t * file_array = getCurrentProcessPCB()->file_array;
-  if (fd >= NUM_MAX_OPEN_FILES || fd < 0) // index out of bounds
+  file_t * file = remove_file(fd);
+  if (file == NULL) // out of bounds, or erroneously trying to close an unopened file.
     return -1;
-  else if (file_array[fd].flags == FILE_AVAIL) // erroneously trying to close an unopened file.
-    return -1;
-  else
-    file_array[fd] = blank;
-  return 0;
+
+  put_file(file);
+
+  // write anything written through this file back to the image
+  return block_cache_sync();
 }
 
 /* file_read
@@ -155,29 +599,196 @@ int32_t file_close(int32_t fd)
  */
 int32_t file_read(int32_t fd, int8_t* buf, int32_t nbytes)
 {
-  file_t * file_array = getCurrentProcessPCB()->file_array;
-  if (fd == 1 || fd == 0) // don't want to read from stdout or stdin using file_read
+  file_t * file = get_file(fd);
+  if (fd == 1 || fd == 0 || file == NULL) // don't want to read from stdout or stdin using file_read
     return -1;
 
-  uint32_t inode = file_array[fd].inode_num;
-  uint32_t offset = file_array[fd].file_position;
+  uint32_t inode = file->inode_num;
+  uint32_t offset = file->file_position;
 
   //return number of bytes read, update file position
   uint32_t read = read_data(inode, offset, (uint8_t *) buf, (uint32_t) nbytes);
-  file_array[fd].file_position += read;
+  file->file_position += read;
   return read;
 }
 
+/* write_data
+ * DESCRIPTION: writes to a file at an offset, overwriting and appending. Data
+ *              blocks the write needs are allocated up front and the inode is
+ *              only updated once, however many blocks it touches. Refused while
+ *              the file is running or mmapped, like truncate_file, since its
+ *              blocks may be mapped straight into those processes
+ * INPUTS: inode - inode number of a regular file
+ *         offset - offset in bytes to start writing at, a gap past the end of the file reads as zeros
+ *         buf - data to write
+ *         length - number of bytes to write
+ * OUTPUTS: changes the file's blocks in the block cache
+ * RETURN VALUE: number of bytes written, fewer than length if the filesystem or
+ *               the file is full, -1 on failure, if the file is mapped or if
+ *               nothing could be written
+ * SIDE EFFECTS: the changes reach the image on write back
+ */
+int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length)
+{
+  buffer_t* inode_buffer;
+  buffer_t* data_buffer;
+  inode_block_t* inode_block;
+  uint32_t end, old_length, new_length, blocks, allocated, index, chunk, count;
+  int32_t block;
+
+  if (buf == NULL || inode_is_mapped(inode))
+    return -1;
+
+  inode_buffer = read_inode(inode);
+  if (inode_buffer == NULL)
+    return -1;
+  inode_block = (inode_block_t*) inode_buffer->data;
+  old_length = inode_block->length;
+
+  end = offset + length;
+  if (end > MAX_FILE_SIZE || end < offset)
+    end = MAX_FILE_SIZE;
+
+  //allocate every block the write needs first
+  blocks = (old_length + NUM_B_IN_FOUR_KB - 1) / NUM_B_IN_FOUR_KB;
+  for (allocated = blocks; allocated * NUM_B_IN_FOUR_KB < end; allocated++){
+    block = alloc_data_block();
+    if (block == -1){
+      //out of space, write what fits
+      end = allocated * NUM_B_IN_FOUR_KB;
+      break;
+    }
+    inode_block->data_block_num[allocated] = block;
+  }
+
+  //a write starting past the end of the file leaves zeros in between
+  for (index = old_length / NUM_B_IN_FOUR_KB; index * NUM_B_IN_FOUR_KB < offset && index < allocated; index++){
+    data_buffer = bread(DATA_BLOCK(inode_block->data_block_num[index]));
+    if (data_buffer == NULL)
+      break;
+    chunk = (index == old_length / NUM_B_IN_FOUR_KB) ? old_length % NUM_B_IN_FOUR_KB : 0;
+    memset(data_buffer->data + chunk, 0, NUM_B_IN_FOUR_KB - chunk);
+    bdirty(data_buffer);
+    brelse(data_buffer);
+  }
+
+  count = 0;
+  while (offset < end){
+    index = offset / NUM_B_IN_FOUR_KB;
+    data_buffer = bread(DATA_BLOCK(inode_block->data_block_num[index]));
+    if (data_buffer == NULL)
+      break;
+    chunk = NUM_B_IN_FOUR_KB - offset % NUM_B_IN_FOUR_KB;
+    if (chunk > end - offset)
+      chunk = end - offset;
+    memcpy(data_buffer->data + offset % NUM_B_IN_FOUR_KB, buf + count, chunk);
+    bdirty(data_buffer);
+    brelse(data_buffer);
+
+    offset += chunk;
+    count += chunk;
+  }
+
+  //the only metadata update, however many blocks were written
+  if (count > 0 && offset > old_length)
+    inode_block->length = offset;
+
+  //give back blocks a failed write allocated but didn't use. The file never shrinks here,
+  //so these are all past its old end and can't have been mapped by file_page_address
+  blocks = (inode_block->length + NUM_B_IN_FOUR_KB - 1) / NUM_B_IN_FOUR_KB;
+  if (blocks < (old_length + NUM_B_IN_FOUR_KB - 1) / NUM_B_IN_FOUR_KB)
+    blocks = (old_length + NUM_B_IN_FOUR_KB - 1) / NUM_B_IN_FOUR_KB;
+  for (index = blocks; index < allocated; index++)
+    free_data_block(inode_block->data_block_num[index]);
+
+  new_length = inode_block->length;
+  if (new_length != old_length)
+    bdirty(inode_buffer);
+  brelse(inode_buffer);
+  if (blocks != (old_length + NUM_B_IN_FOUR_KB - 1) / NUM_B_IN_FOUR_KB)
+    build_extent_table(inode);
+
+  if (count == 0 && length > 0)
+    return -1;
+  return count;
+}
+
 /* file_write
- * DESCRIPTION: does nothing b/c this is a read only file system
+ * DESCRIPTION: writes nbytes from buf at the file position
  * INPUTS: file descriptor, pointer to buffer, number of bytes
- * OUTPUTS: always return -1
- * RETURN VALUE: int 0 on success, int -1 on failure
- * SIDE EFFECTS:
+ * OUTPUTS: changes the file through write_data
+ * RETURN VALUE: number of bytes written, fewer than nbytes if the filesystem or
+ *               the file is full, -1 on failure or if nothing could be written
+ * SIDE EFFECTS: advances the file position
  */
 int32_t file_write(int32_t fd, const int8_t* buf, int32_t nbytes)
 {
-  return -1; // this function does nothing, always fails
+  file_t * file = get_file(fd);
+  int32_t written;
+
+  if (fd == 1 || fd == 0 || file == NULL || nbytes < 0) // don't want to write to stdout or stdin using file_write
+    return -1;
+
+  written = write_data(file->inode_num, file->file_position, (const uint8_t *) buf, (uint32_t) nbytes);
+  if (written > 0)
+    file->file_position += written;
+  return written;
+}
+
+/* file_pread
+ * DESCRIPTION: reads up to nbytes of a file starting at offset, without
+ *              using or moving the file position
+ * INPUTS: file descriptor, pointer to buffer, number of bytes, offset in the file
+ * OUTPUTS: data copied into buf
+ * RETURN VALUE: number of bytes read, -1 on failure
+ * SIDE EFFECTS: uses read_data
+ */
+int32_t file_pread(int32_t fd, int8_t* buf, int32_t nbytes, uint32_t offset)
+{
+  file_t * file = get_file(fd);
+  if (fd == 1 || fd == 0 || file == NULL || nbytes < 0)
+    return -1;
+  return read_data(file->inode_num, offset, (uint8_t *) buf, (uint32_t) nbytes);
+}
+
+/* file_pwrite
+ * DESCRIPTION: writes nbytes to a file starting at offset, without using or
+ *              moving the file position
+ * INPUTS: file descriptor, pointer to buffer, number of bytes, offset in the file
+ * OUTPUTS: changes the file through write_data
+ * RETURN VALUE: number of bytes written, -1 on failure
+ * SIDE EFFECTS: none
+ */
+int32_t file_pwrite(int32_t fd, const int8_t* buf, int32_t nbytes, uint32_t offset)
+{
+  file_t * file = get_file(fd);
+  if (fd == 1 || fd == 0 || file == NULL || nbytes < 0)
+    return -1;
+  return write_data(file->inode_num, offset, (const uint8_t *) buf, (uint32_t) nbytes);
+}
+
+/* no_pread
+ * DESCRIPTION: pread for files without positions (terminal, RTC, directory)
+ * INPUTS: ignored
+ * OUTPUTS: none
+ * RETURN VALUE: always -1
+ * SIDE EFFECTS: none
+ */
+static int32_t no_pread(int32_t fd, int8_t* buf, int32_t nbytes, uint32_t offset)
+{
+  return -1;
+}
+
+/* no_pwrite
+ * DESCRIPTION: pwrite for files without positions (terminal, RTC, directory)
+ * INPUTS: ignored
+ * OUTPUTS: none
+ * RETURN VALUE: always -1
+ * SIDE EFFECTS: none
+ */
+static int32_t no_pwrite(int32_t fd, const int8_t* buf, int32_t nbytes, uint32_t offset)
+{
+  return -1;
 }
 
 /* directory_open
@@ -185,19 +796,21 @@ int32_t file_write(int32_t fd, const int8_t* buf, int32_t nbytes)
  * INPUTS: pointer to 8 bit filename
  * OUTPUTS:
  * RETURN VALUE: int fd on success, int -1 on failure
- * SIDE EFFECTS: uses read_dentry_by_name
+ * SIDE EFFECTS: uses read_dentry_by_name once, then opens the dentry it found
  */
 int32_t directory_open(const uint8_t* filename)
 {
   dentry_t new_dent;
 
+  if (filename == NULL || strlen((int8_t*) filename) > MAX_PATH_LEN)
+    return -1;
   //file with matching file name not found, return -1
   if (read_dentry_by_name(filename, &new_dent) == -1)
       return -1;
   if (new_dent.filetype != 1) // not a directory
     return -1;
 
-  return file_open(filename);
+  return open_dentry(&new_dent);
 }
 
 /* directory_close
@@ -217,16 +830,18 @@ int32_t directory_close(int32_t fd)
  * INPUTS: file descriptor, pointer to buffer, number of bytes
  * OUTPUTS:
  * RETURN VALUE: number of bytes read
- * SIDE EFFECTS: uses read_dentry_by_index
+ * SIDE EFFECTS: uses read_dir_entry
  */
 int32_t directory_read(int32_t fd, int8_t* buf, int32_t nbytes)
 {
-  file_t * file_array = getCurrentProcessPCB()->file_array;
+  file_t * file = get_file(fd);
   dentry_t new_dent;
   int32_t i = 0;
-  if (read_dentry_by_index(file_array[fd].file_position, &new_dent) == -1)
+  if (file == NULL)
+    return -1;
+  if (read_dir_entry(file->inode_num, file->file_position, &new_dent) == -1)
     return -1;
-  file_array[fd].file_position++;
+  file->file_position++;
   while (new_dent.filename[i] != '\0' && i < 32) {
       buf[i] = new_dent.filename[i];
       i++;
@@ -247,17 +862,236 @@ int32_t directory_write(int32_t fd, const int8_t* buf, int32_t nbytes)
   return -1; // this function does nothing, always fails
 }
 
+/* dentry_hash
+ * DESCRIPTION: FNV-1a hash of a file name, only the first FILENAME_LEN
+ *              characters count, like the name comparison
+ * INPUTS: fname - filename
+ * OUTPUTS: none
+ * RETURN VALUE: the hash
+ */
+static uint32_t dentry_hash(const int8_t* fname)
+{
+  uint32_t hash = FNV_OFFSET_BASIS;
+  uint32_t i;
+
+  for (i = 0; i < FILENAME_LEN && fname[i] != '\0'; i++){
+    hash ^= (uint8_t) fname[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+/* build_dentry_index
+ * DESCRIPTION: hashes every directory entry in the boot block into the root
+ *              directory's index. Called at mount time, and again whenever the
+ *              root directory changes
+ * INPUTS: none
+ * OUTPUTS: none
+ * RETURN VALUE: none
+ * SIDE EFFECTS: rebuilds dentry_hash_head and dentry_hash_next
+ */
+void build_dentry_index(void)
+{
+  uint32_t index, bucket, dir_count;
+
+  for (bucket = 0; bucket < DENTRY_HASH_SIZE; bucket++)
+    dentry_hash_head[bucket] = -1;
+
+  dir_count = boot_block->dir_count;
+  if (dir_count > NUM_FILES)
+    dir_count = NUM_FILES;
+
+  // insert backwards so each chain lists entries in directory order, like the old linear scan
+  for (index = dir_count; index-- > 0; ){
+    bucket = dentry_hash(boot_block->direntries[index].filename) & (DENTRY_HASH_SIZE - 1);
+    dentry_hash_next[index] = dentry_hash_head[bucket];
+    dentry_hash_head[bucket] = index;
+  }
+}
+
+/* dir_entry_count
+ * DESCRIPTION: finds how many entries a directory holds
+ * INPUTS: dir - inode of the directory, ROOT_DIR_INODE for the root
+ * OUTPUTS: none
+ * RETURN VALUE: number of entries, -1 on a bad inode
+ * SIDE EFFECTS: none
+ */
+static int32_t dir_entry_count(int32_t dir)
+{
+  buffer_t* inode_buffer;
+  int32_t count;
+
+  if (dir == ROOT_DIR_INODE)
+    return (boot_block->dir_count > NUM_FILES) ? NUM_FILES : boot_block->dir_count;
+
+  inode_buffer = read_inode(dir);
+  if (inode_buffer == NULL)
+    return -1;
+  count = ((inode_block_t*) inode_buffer->data)->length / sizeof(dentry_t);
+  brelse(inode_buffer);
+  return count;
+}
+
+/* read_dir_entry
+ * DESCRIPTION: reads one entry of a directory, from the boot block for the root
+ *              and from the directory's data blocks otherwise
+ * INPUTS: dir - inode of the directory, ROOT_DIR_INODE for the root
+ *         index - index of the entry in the directory
+ * OUTPUTS: the entry in dentry
+ * RETURN VALUE: 0 on success, -1 past the end of the directory or on a bad inode
+ * SIDE EFFECTS: none
+ */
+static int32_t read_dir_entry(int32_t dir, uint32_t index, dentry_t* dentry)
+{
+  if (dir == ROOT_DIR_INODE){
+    if ((int32_t) index >= dir_entry_count(dir))
+      return -1;
+    return read_dentry_by_index(index, dentry);
+  }
+  if (read_data(dir, index * sizeof(dentry_t), (uint8_t*) dentry, sizeof(dentry_t)) != sizeof(dentry_t))
+    return -1;
+  return 0;
+}
+
+/* dcache_slot
+ * DESCRIPTION: finds the dcache slot of a name in a directory
+ * INPUTS: parent - inode of the directory, hash - dentry_hash of the name
+ * OUTPUTS: none
+ * RETURN VALUE: the slot
+ */
+static dcache_entry_t* dcache_slot(int32_t parent, uint32_t hash)
+{
+  return &dcache[(hash ^ ((uint32_t) parent * FNV_PRIME)) & (DCACHE_SIZE - 1)];
+}
+
+/* dcache_insert
+ * DESCRIPTION: remembers the result of looking up a name in a directory
+ * INPUTS: parent - inode of the directory, name - the name, hash - its dentry_hash
+ *         dentry - the entry found, NULL if there is none
+ * OUTPUTS: fills the name's dcache slot
+ * RETURN VALUE: none
+ * SIDE EFFECTS: drops whatever the slot held before
+ */
+static void dcache_insert(int32_t parent, const int8_t* name, uint32_t hash, const dentry_t* dentry)
+{
+  dcache_entry_t* entry = dcache_slot(parent, hash);
+
+  entry->parent = parent;
+  entry->hash = hash;
+  strncpy(entry->filename, name, FILENAME_LEN);
+  entry->filetype = (dentry == NULL) ? -1 : dentry->filetype;
+  entry->inode_num = (dentry == NULL) ? 0 : dentry->inode_num;
+  entry->valid = 1;
+}
+
+/* lookup_in_dir
+ * DESCRIPTION: finds a name in one directory. The dcache is tried first, then
+ *              the hash index for the root or a scan of the entries for any
+ *              other directory, and the result goes into the dcache
+ * INPUTS: dir - inode of the directory, ROOT_DIR_INODE for the root
+ *         name - a single path component
+ * OUTPUTS: the entry in dentry
+ * RETURN VALUE: 0 on success, -1 if the name isn't in the directory
+ * SIDE EFFECTS: updates the dcache
+ */
+static int32_t lookup_in_dir(int32_t dir, const int8_t* name, dentry_t* dentry)
+{
+  dcache_entry_t* entry;
+  dentry_t entries[DIR_SCAN_ENTRIES];
+  uint32_t hash, offset;
+  int32_t index, read, i;
+
+  hash = dentry_hash(name);
+  entry = dcache_slot(dir, hash);
+  if (entry->valid && entry->parent == dir && entry->hash == hash &&
+      strncmp(name, entry->filename, FILENAME_LEN) == 0){
+    if (entry->filetype == -1)
+      return -1;
+    memset(dentry, 0, sizeof(dentry_t));
+    strncpy(dentry->filename, entry->filename, FILENAME_LEN);
+    dentry->filetype = entry->filetype;
+    dentry->inode_num = entry->inode_num;
+    return 0;
+  }
+
+  if (dir == ROOT_DIR_INODE){
+    //only the entries that hash to the same bucket need a name comparison
+    for (index = dentry_hash_head[hash & (DENTRY_HASH_SIZE - 1)]; index != -1; index = dentry_hash_next[index]){
+      if (strncmp(name, boot_block->direntries[index].filename, FILENAME_LEN) == 0){
+        read_dentry_by_index(index, dentry);
+        dcache_insert(dir, name, hash, dentry);
+        return 0;
+      }
+    }
+  }
+  else{
+    //read the directory a few entries at a time
+    for (offset = 0; (read = read_data(dir, offset, (uint8_t*) entries, sizeof(entries))) > 0; offset += read){
+      for (i = 0; i < read / (int32_t) sizeof(dentry_t); i++){
+        if (strncmp(name, entries[i].filename, FILENAME_LEN) == 0){
+          *dentry = entries[i];
+          dcache_insert(dir, name, hash, dentry);
+          return 0;
+        }
+      }
+    }
+  }
+
+  dcache_insert(dir, name, hash, NULL);
+  return -1;
+}
+
+/* is_dot_name
+ * DESCRIPTION: checks for the "." and ".." entries, which never name a child
+ * INPUTS: name - a path component or directory entry name
+ * OUTPUTS: none
+ * RETURN VALUE: 1 for "." or "..", 0 otherwise
+ */
+static int32_t is_dot_name(const int8_t* name)
+{
+  return strncmp(name, ".", FILENAME_LEN) == 0 || strncmp(name, "..", FILENAME_LEN) == 0;
+}
+
+/* next_component
+ * DESCRIPTION: splits the next component off a path, skipping slashes
+ * INPUTS: path - where to start, moved past the component
+ * OUTPUTS: the NUL terminated component in name, which holds FILENAME_LEN + 1 bytes
+ * RETURN VALUE: length of the component, 0 at the end of the path, -1 if it is
+ *               longer than FILENAME_LEN
+ * SIDE EFFECTS: none
+ */
+static int32_t next_component(const uint8_t** path, int8_t* name)
+{
+  int32_t length = 0;
+
+  while (**path == '/')
+    (*path)++;
+  while (**path != '\0' && **path != '/'){
+    if (length == FILENAME_LEN)
+      return -1;
+    name[length++] = *(*path)++;
+  }
+  name[length] = '\0';
+  return length;
+}
+
 // function interfaces copied from lecture slides
 /* read_dentry_by_name
- * DESCRIPTION: reads directory entry by name
- * INPUTS: fname - filename
- * OUTPUTS: corresponding directory entry stored in dentry
+ * DESCRIPTION: reads the directory entry a path leads to, one component at a
+ *              time through lookup_in_dir. Paths start at the root whether or
+ *              not they begin with '/', "." and ".." work in any directory
+ * INPUTS: fname - path of the file
+ * OUTPUTS: corresponding directory entry stored in dentry. A path ending at a
+ *          directory reached through "." or ".." (or the root) gets an entry made up
+ *          for it, with ROOT_DIR_INODE for the root
  * RETURN VALUE: int 0 on success, int -1 on failure
  */
 int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry)
 {
-  //Scans through the directory entries in the “boot block” to find the file name
-  uint32_t index;
+  int32_t dirs[MAX_PATH_DEPTH + 1];
+  int8_t name[FILENAME_LEN + 1];
+  int32_t depth = 0;
+  int32_t length;
 
   if (fname == NULL){
     return -1;
@@ -267,21 +1101,120 @@ int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry)
   if(fname[0] == '\0')
     return -1;
 
-  //locate directory entry corresponding to the name passed in as argument
-  for (index = 0; index < NUM_FILES; index++){
+  //start out at the root
+  dirs[0] = ROOT_DIR_INODE;
+  memset(dentry, 0, sizeof(dentry_t));
+  dentry->filename[0] = '.';
+  dentry->filetype = 1;
+  dentry->inode_num = ROOT_DIR_INODE;
+
+  while ((length = next_component(&fname, name)) != 0){
+    //too long a name, or a path that goes on past something that isn't a directory
+    if (length == -1 || dentry->filetype != 1)
+      return -1;
+
+    if (strncmp(name, ".", FILENAME_LEN) == 0)
+      continue;
 
-    //if one character does not match, skip to next directory entry
-    if (strncmp((int8_t*) fname, ((boot_block_t*) fs_ptr)->direntries[index].filename, FILENAME_LEN) == 0){
+    if (strncmp(name, "..", FILENAME_LEN) == 0){
+      if (depth > 0)
+        depth--;
+      memset(dentry, 0, sizeof(dentry_t));
+      strncpy(dentry->filename, name, FILENAME_LEN);
+      dentry->filetype = 1;
+      dentry->inode_num = dirs[depth];
+      continue;
+    }
+
+    if (lookup_in_dir(dirs[depth], name, dentry) == -1)
+      return -1;
+    if (dentry->filetype == 1){
+      if (depth == MAX_PATH_DEPTH)
+        return -1;
+      dirs[++depth] = dentry->inode_num;
+    }
+  }
+  return 0;
+}
+
+/* directory_getdents
+ * DESCRIPTION: reads as many directory entries as fit into buf, starting at
+ *              the directory position. Each is a dirent_t holding the name,
+ *              file type, inode and length, packed back to back with reclen
+ *              giving the size of each one
+ * INPUTS: file descriptor, pointer to buffer, number of bytes
+ * OUTPUTS: dirent_t records in buf
+ * RETURN VALUE: number of bytes filled, 0 at the end of the directory, -1 if
+ *               not even the next entry fits
+ * SIDE EFFECTS: advances the directory position past the entries returned
+ */
+int32_t directory_getdents(int32_t fd, void* buf, int32_t nbytes)
+{
+  file_t * file = get_file(fd);
+  dirent_t * dirent;
+  buffer_t * inode_buffer;
+  dentry_t entry;
+  dentry_t * dentry = &entry;
+  uint32_t namelen, reclen;
+  int32_t dir_count;
+  int32_t filled = 0;
+
+  if (file == NULL || buf == NULL || nbytes < 0)
+    return -1;
+
+  dir_count = dir_entry_count(file->inode_num);
+  if (dir_count == -1)
+    return -1;
 
-      //Populates the dentry parameter -> file name, file type, inode number
-      read_dentry_by_index(index, dentry);
+  for (; file->file_position < dir_count; file->file_position++){
+    if (read_dir_entry(file->inode_num, file->file_position, dentry) == -1)
+      return -1;
+    for (namelen = 0; namelen < FILENAME_LEN && dentry->filename[namelen] != '\0'; namelen++);
+    reclen = (DIRENT_HEADER_SIZE + namelen + 1 + 3) & ~3;
+    if (filled + reclen > (uint32_t) nbytes)
+      break;
 
-      //file found so return success
-      return 0;
+    dirent = (dirent_t *) ((uint8_t *) buf + filled);
+    dirent->reclen = reclen;
+    dirent->type = dentry->filetype;
+    dirent->namelen = namelen;
+    dirent->inode = dentry->inode_num;
+    dirent->size = 0;
+    if (dentry->filetype == 2 && (inode_buffer = read_inode(dentry->inode_num)) != NULL){
+      dirent->size = ((inode_block_t *) inode_buffer->data)->length;
+      brelse(inode_buffer);
     }
+    memcpy(dirent->name, dentry->filename, namelen);
+    memset(dirent->name + namelen, 0, reclen - DIRENT_HEADER_SIZE - namelen);
+    filled += reclen;
   }
 
-  //file not found so return -1
+  if (filled == 0 && file->file_position < dir_count)
+    return -1; // buffer too small for the next entry
+  return filled;
+}
+
+/* no_getdents
+ * DESCRIPTION: getdents for anything that isn't a directory
+ * INPUTS: ignored
+ * OUTPUTS: none
+ * RETURN VALUE: always -1
+ * SIDE EFFECTS: none
+ */
+static int32_t no_getdents(int32_t fd, void* buf, int32_t nbytes)
+{
+  return -1;
+}
+
+/* no_ioctl
+ * DESCRIPTION: ioctl for files that have no requests (regular files, directories, RTC)
+ * INPUTS: ignored
+ * OUTPUTS: none
+ * RETURN VALUE: always -1
+ * SIDE EFFECTS: none
+ */
+static int32_t no_ioctl(int32_t fd, int32_t request, int32_t arg)
+{
   return -1;
 }
 
@@ -300,13 +1233,145 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry)
   }
 
   //copy dentry
-  *dentry = ((boot_block_t*) fs_ptr)->direntries[index];
+  *dentry = boot_block->direntries[index];
 
   return 0;
 }
 
+/* fill_extent_table
+ * DESCRIPTION: groups the data blocks of an inode into runs of consecutive
+ *              data blocks
+ * INPUTS: table - empty table to fill, inode_block - the inode
+ * OUTPUTS: table
+ * RETURN VALUE: 0 on success, -1 on a bad block number or out of memory
+ * SIDE EFFECTS: allocates the extents with kmalloc
+ */
+static int32_t fill_extent_table(extent_table_t* table, inode_block_t* inode_block)
+{
+  uint32_t blocks, index, runs;
+  int32_t block;
+
+  blocks = (inode_block->length + NUM_B_IN_FOUR_KB - 1) / NUM_B_IN_FOUR_KB;
+  if (blocks == 0)
+    return 0;
+  if (blocks > MAX_INODE_BLOCKS)
+    return -1;
+
+  //first pass counts the runs and checks every block number
+  runs = 0;
+  for (index = 0; index < blocks; index++){
+    block = inode_block->data_block_num[index];
+    if (block < 0 || block >= boot_block->data_count)
+      return -1;
+    if (index == 0 || block != inode_block->data_block_num[index - 1] + 1)
+      runs++;
+  }
+
+  table->extents = (extent_t*) kmalloc(runs * sizeof(extent_t));
+  if (table->extents == NULL)
+    return -1;
+
+  //second pass fills them in
+  runs = 0;
+  for (index = 0; index < blocks; index++){
+    block = inode_block->data_block_num[index];
+    if (index == 0 || block != inode_block->data_block_num[index - 1] + 1){
+      table->extents[runs].file_block = index;
+      table->extents[runs].data_block = block;
+      table->extents[runs].count = 0;
+      runs++;
+    }
+    table->extents[runs - 1].count++;
+  }
+  table->count = runs;
+  return 0;
+}
+
+/* build_extent_table
+ * DESCRIPTION: (re)builds the extent table of an inode so read_data can look
+ *              up runs of consecutive data blocks without walking data_block_num
+ * INPUTS: inode - inode number
+ * OUTPUTS: replaces the inode's entry in extent_tables
+ * RETURN VALUE: 0 on success, -1 if the inode has no table (bad inode or block
+ *               number, or out of memory), read_data then works from data_block_num
+ * SIDE EFFECTS: allocates the table with kmalloc and frees the old one
+ */
+int32_t build_extent_table(uint32_t inode)
+{
+  extent_table_t* table;
+  buffer_t* inode_buffer;
+  int32_t ret;
+
+  if (extent_tables == NULL || inode >= boot_block->inode_count)
+    return -1;
+
+  table = &extent_tables[inode];
+  kfree(table->extents);
+  table->extents = NULL;
+  table->count = 0;
+
+  inode_buffer = read_inode(inode);
+  if (inode_buffer == NULL)
+    return -1;
+  ret = fill_extent_table(table, (inode_block_t*) inode_buffer->data);
+  brelse(inode_buffer);
+  return ret;
+}
+
+/* find_block_run
+ * DESCRIPTION: finds how many blocks starting at a block of a file are stored
+ *              in consecutive data blocks, from the extent table when the
+ *              inode has one and from data_block_num otherwise
+ * INPUTS: inode - inode number
+ *         inode_block - its inode block
+ *         index_in_inode - index in data_block_num of the first block
+ *         blocks - number of blocks in the file
+ * OUTPUTS: data_block - data block number of the first block
+ * RETURN VALUE: length of the run in blocks, or -1 on an invalid data block number
+ */
+static int32_t find_block_run(uint32_t inode, inode_block_t* inode_block, uint32_t index_in_inode,
+                              uint32_t blocks, uint32_t* data_block)
+{
+  extent_table_t* table;
+  uint32_t low, high, mid, run;
+  int32_t block;
+
+  table = (extent_tables == NULL) ? NULL : &extent_tables[inode];
+  if (table != NULL && table->extents != NULL){
+    //binary search for the last extent starting at or before the block
+    low = 0;
+    high = table->count;
+    while (high - low > 1){
+      mid = (low + high) / 2;
+      if (table->extents[mid].file_block <= index_in_inode)
+        low = mid;
+      else
+        high = mid;
+    }
+    run = index_in_inode - table->extents[low].file_block;
+    *data_block = table->extents[low].data_block + run;
+    return table->extents[low].count - run;
+  }
+
+  block = inode_block->data_block_num[index_in_inode];
+  if (block < 0 || block >= boot_block->data_count)
+    return -1;
+  *data_block = block;
+
+  //extend the run while the next block follows this one in the image
+  for (run = 1; index_in_inode + run < blocks; run++){
+    if (inode_block->data_block_num[index_in_inode + run] != block + (int32_t) run)
+      break;
+  }
+  return run;
+}
+
 /* read_data
- * DESCRIPTION: reads data from a file
+ * DESCRIPTION: reads data from a file. Runs of consecutive blocks the device keeps
+ *              in memory are copied with one memcpy, anything else goes through the
+ *              block cache. A read that starts where the last one on the file stopped
+ *              (or at the start) also reads ahead the next few blocks not read ahead
+ *              already, since a sequential reader asks for them next
  * INPUTS: inode - inode number corresponding to a file
  * 				 offset - offset in bytes to start reading the file from
  *				 buf - buffer to read into
@@ -317,118 +1382,338 @@ int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry)
  */
 int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length)
 {
-  int32_t count, index_in_inode, index_in_data_block, data_block_num, done;
+  buffer_t* inode_buffer;
+  buffer_t* data_buffer;
   inode_block_t* inode_block;
-  uint8_t* data_block;
+  read_ahead_t* state;
+  uint32_t count, start, end, blocks, index_in_inode, data_block, run_end, chunk, ahead_end;
+  uint8_t* source;
+  int32_t run;
 
   //if inode number is out of range, return -1
-  if (inode >= ((boot_block_t*) fs_ptr)->inode_count){
+  inode_buffer = read_inode(inode);
+  if (inode_buffer == NULL){
     return -1;
   }
+  inode_block = (inode_block_t*) inode_buffer->data;
 
-  //initialize count of # bytes read and placed in the buffer
-  count = 0;
-
-  //get inode block
-  inode_block = (inode_block_t*) (fs_ptr + NUM_B_IN_FOUR_KB * (inode + 1));
-
-  //if trying to begin reading beyond end of file, return -1
+  //if trying to begin reading beyond end of file, nothing is read
   if (offset >= inode_block->length){
-    return count;
+    brelse(inode_buffer);
+    return 0;
   }
 
-  //calculate index into inode of data block
-  index_in_inode = offset / NUM_B_IN_FOUR_KB;
-
-  //initialize index in data block
-  index_in_data_block = offset % NUM_B_IN_FOUR_KB;
-
-  //set flag
-  done = 0;
-
-  //while not done reading into buf,
-  while (done == 0){
+  //stop at whichever comes first, the end of the file or length bytes
+  end = inode_block->length;
+  if (length < end - offset)
+    end = offset + length;
+  blocks = (inode_block->length + NUM_B_IN_FOUR_KB - 1) / NUM_B_IN_FOUR_KB;
 
-    //calculate data block number
-    data_block_num = inode_block->data_block_num[index_in_inode];
+  start = offset;
+  count = 0;
+  while (offset < end){
+    index_in_inode = offset / NUM_B_IN_FOUR_KB;
 
-    //check for invalid block data number
-    if (data_block_num >= ((boot_block_t*) fs_ptr)->data_count){
+    run = find_block_run(inode, inode_block, index_in_inode, blocks, &data_block);
+    if (run == -1){
+      brelse(inode_buffer);
       return -1;
     }
 
-    //get data block
-    data_block = (uint8_t*) (fs_ptr + NUM_B_IN_FOUR_KB * (((boot_block_t*) fs_ptr)->inode_count + data_block_num + 1));
+    //copy to the end of the run, or less if the read ends first
+    run_end = (index_in_inode + run) * NUM_B_IN_FOUR_KB;
+    if (run_end > end)
+      run_end = end;
 
-    //while not yet read length # of bytes AND not yet reached end of data block
-    //AND not yet reached end of file, read into buf
-    while (count < length && index_in_data_block < NUM_B_IN_FOUR_KB && offset < inode_block->length){
-      buf[count] = data_block[index_in_data_block];
-      index_in_data_block++;
-      offset++;
-      count++;
+    //all at once if the blocks sit next to each other in memory with nothing newer in the cache
+    chunk = (run_end - 1) / NUM_B_IN_FOUR_KB - index_in_inode + 1;
+    source = block_run_address(DATA_BLOCK(data_block), chunk);
+    if (source != NULL){
+      block_cache_stats.direct += chunk;    //still accounted for, though they skip the buffers
+      memcpy(buf + count, source + offset % NUM_B_IN_FOUR_KB, run_end - offset);
+      count += run_end - offset;
+      offset = run_end;
+      continue;
     }
 
-    //if read the maximum number of bytes into buf or going out of bounds of the file,
-    //end prematurely
-    if (count >= length || offset >= inode_block->length){
-      done = 1;
-    }
+    //otherwise block by block through the cache
+    while (offset < run_end){
+      data_buffer = bread(DATA_BLOCK(data_block));
+      if (data_buffer == NULL){
+        brelse(inode_buffer);
+        return -1;
+      }
+      chunk = NUM_B_IN_FOUR_KB - offset % NUM_B_IN_FOUR_KB;
+      if (chunk > run_end - offset)
+        chunk = run_end - offset;
+      memcpy(buf + count, data_buffer->data + offset % NUM_B_IN_FOUR_KB, chunk);
+      brelse(data_buffer);
 
-    //reset index into data block as a new block is now going to be read
-    index_in_data_block = 0;
+      offset += chunk;
+      count += chunk;
+      data_block++;
+    }
+  }
 
-    //look at next data block
-    index_in_inode++;
+  //read ahead for sequential reads only, up to READ_AHEAD_BLOCKS past the block the read ended in.
+  //Blocks already read ahead are skipped, so small reads don't ask for the same blocks every time,
+  //and so are blocks the device keeps in memory, which the copy above takes straight from it
+  if (read_ahead_state != NULL && inode < boot_block->inode_count){
+    state = &read_ahead_state[inode];
+    if (start != state->next_offset || start == 0)
+      state->ahead_end = 0;   //a jump, or a new pass from the start, begins a new window
+    if (start == state->next_offset || start == 0){
+      index_in_inode = (offset + NUM_B_IN_FOUR_KB - 1) / NUM_B_IN_FOUR_KB;
+      ahead_end = index_in_inode + READ_AHEAD_BLOCKS;
+      if (ahead_end > blocks)
+        ahead_end = blocks;
+      if (index_in_inode < state->ahead_end)
+        index_in_inode = state->ahead_end;
+      for (; index_in_inode < ahead_end; index_in_inode += run){
+        run = find_block_run(inode, inode_block, index_in_inode, blocks, &data_block);
+        if (run == -1)
+          break;
+        if (run > ahead_end - index_in_inode)
+          run = ahead_end - index_in_inode;
+        block_cache_read_ahead(DATA_BLOCK(data_block), run);
+      }
+      if (ahead_end > state->ahead_end)
+        state->ahead_end = ahead_end;
+    }
+    state->next_offset = offset;
   }
 
+  brelse(inode_buffer);
+
   //return # of bytes read into buf
   return count;
 }
 
 /* init_vfs
- * DESCRIPTION: sets virtual file system pointer for use in vfs
- * INPUTS: int that will be treated as pointer to file system
- * OUTPUTS: sets fs_ptr, populates entries of blank
+ * DESCRIPTION: mounts the filesystem on a block device
+ * INPUTS: device holding the filesystem image
+ * OUTPUTS: sets up the block cache, builds the dentry index, free maps and
+ *          extent tables, sets up the open file cache
  * RETURN VALUE: none
- * SIDE EFFECTS: sets fs_ptr
+ * SIDE EFFECTS: holds the boot block in the block cache
  */
-void init_vfs(uint32_t ptr)
+void init_vfs(block_device_t* dev)
 {
-  fs_ptr = (uint8_t *) ptr;
+  uint32_t inode;
+
+  // done here to ensure it happens before the first process opens anything
+  kmem_cache_init(&file_cache, "file", sizeof(file_t));
 
-  // set values of blank file array entry - done here to ensure it happens first
-  blank.file_ops_table_ptr = 0;
-  blank.inode_num = 0;
-  blank.file_position = 0;
-  blank.flags = FILE_AVAIL;
+  if (block_cache_init(dev) == -1 || (boot_buffer = bread(0)) == NULL){
+    printf("vfs: can't read the boot block from %s\n", dev->name);
+    return;
+  }
+  boot_block = (boot_block_t*) boot_buffer->data;
+  build_dentry_index();
+  build_free_maps();
+
+  //read ahead state, a read from the start of a file always counts as sequential
+  read_ahead_state = (read_ahead_t*) kmalloc(boot_block->inode_count * sizeof(read_ahead_t));
+  if (read_ahead_state != NULL)
+    memset(read_ahead_state, 0, boot_block->inode_count * sizeof(read_ahead_t));
+
+  //extent tables are only a speedup, read_data still works if any of them are missing
+  extent_tables = (extent_table_t*) kmalloc(boot_block->inode_count * sizeof(extent_table_t));
+  if (extent_tables != NULL){
+    memset(extent_tables, 0, boot_block->inode_count * sizeof(extent_table_t));
+    for (inode = 0; inode < boot_block->inode_count; inode++)
+      build_extent_table(inode);
+  }
 }
 
-/* init_file_array
- * DESCRIPTION: populates file array with all blank entries
- * INPUTS: none
- * OUTPUTS: sets all entries in file array to blanks
+/* put_file
+ * DESCRIPTION: drops one descriptor's reference to an open file, freeing it
+ *              with the last one
+ * INPUTS: the open file
+ * OUTPUTS: none
  * RETURN VALUE: none
+ * SIDE EFFECTS: may free the file
+ */
+void put_file(file_t * file)
+{
+  if (--file->refcount == 0)
+    kmem_cache_free(&file_cache, file);
+}
+
+/* get_file
+ * DESCRIPTION: looks up an open file of the current process
+ * INPUTS: file descriptor
+ * OUTPUTS: none
+ * RETURN VALUE: the open file, NULL if fd is out of range or not open
+ * SIDE EFFECTS: none
+ */
+file_t * get_file(int32_t fd)
+{
+  fd_table_t * fd_table = &getCurrentProcessPCB()->fd_table;
+
+  if (fd < 0 || (uint32_t) fd >= fd_table->size)
+    return NULL;
+  return fd_table->files[fd];
+}
+
+/* grow_fd_table
+ * DESCRIPTION: doubles the room in a descriptor table, up to NUM_MAX_OPEN_FILES
+ * INPUTS: the table
+ * OUTPUTS: moves the table's files to a bigger array
+ * RETURN VALUE: 0 on success, -1 if it is at the limit or out of memory
+ * SIDE EFFECTS: allocates with kmalloc
+ */
+static int32_t grow_fd_table(fd_table_t * fd_table)
+{
+  file_t ** files;
+  uint32_t size = fd_table->size * 2;
+
+  if (size > NUM_MAX_OPEN_FILES)
+    size = NUM_MAX_OPEN_FILES;
+  if (size <= fd_table->size)
+    return -1;
+
+  files = (file_t **) kmalloc(size * sizeof(file_t *));
+  if (files == NULL)
+    return -1;
+  memcpy(files, fd_table->files, fd_table->size * sizeof(file_t *));
+  memset(files + fd_table->size, 0, (size - fd_table->size) * sizeof(file_t *));
+  kfree(fd_table->files);
+  fd_table->files = files;
+  fd_table->size = size;
+  return 0;
+}
+
+/* install_file
+ * DESCRIPTION: gives an open file the lowest free descriptor of the current
+ *              process. The bitmap finds it a word at a time, and the table
+ *              grows if every descriptor it has room for is taken
+ * INPUTS: the open file
+ * OUTPUTS: stores the file in the descriptor table
+ * RETURN VALUE: the descriptor, -1 if the process has NUM_MAX_OPEN_FILES open or memory runs out
+ * SIDE EFFECTS: none
+ */
+int32_t install_file(file_t * file)
+{
+  fd_table_t * fd_table = &getCurrentProcessPCB()->fd_table;
+  uint32_t word, fd;
+
+  for (word = 0; word < NUM_MAX_OPEN_FILES / 32; word++){
+    if (fd_table->open_map[word] != 0xFFFFFFFF)
+      break;
+  }
+  if (word == NUM_MAX_OPEN_FILES / 32)
+    return -1;
+
+  fd = word * 32 + find_first_set(~fd_table->open_map[word]);
+  if (fd >= fd_table->size && grow_fd_table(fd_table) == -1)
+    return -1;
+
+  fd_table->open_map[word] |= 1 << (fd % 32);
+  fd_table->files[fd] = file;
+  return fd;
+}
+
+/* remove_file
+ * DESCRIPTION: frees a descriptor of the current process
+ * INPUTS: file descriptor
+ * OUTPUTS: none
+ * RETURN VALUE: the file it held, NULL if it was not open
+ * SIDE EFFECTS: the caller drops the file's reference
+ */
+file_t * remove_file(int32_t fd)
+{
+  fd_table_t * fd_table = &getCurrentProcessPCB()->fd_table;
+  file_t * file = get_file(fd);
+
+  if (file == NULL)
+    return NULL;
+  fd_table->files[fd] = NULL;
+  fd_table->open_map[fd / 32] &= ~(1 << (fd % 32));
+  return file;
+}
+
+/* init_fd_table
+ * DESCRIPTION: sets up a new process's descriptor table with only stdin and stdout open
+ * INPUTS: descriptor table of the new process, zeroed
+ * OUTPUTS: allocates the table and the stdin and stdout files
+ * RETURN VALUE: 0 on success, -1 if out of memory
  * SIDE EFFECTS: none
  */
-void init_file_array(file_t * file_array)
+int32_t init_fd_table(fd_table_t * fd_table)
 {
+  file_t * file;
   uint32_t i;
-  // initialize file_array to default values
-  for (i = 0; i < NUM_MAX_OPEN_FILES; i++)
+
+  fd_table->files = (file_t **) kmalloc(NUM_INITIAL_OPEN_FILES * sizeof(file_t *));
+  if (fd_table->files == NULL)
+    return -1;
+  memset(fd_table->files, 0, NUM_INITIAL_OPEN_FILES * sizeof(file_t *));
+  memset(fd_table->open_map, 0, sizeof(fd_table->open_map));
+  fd_table->size = NUM_INITIAL_OPEN_FILES;
+
+  // stdin and stdout
+  for (i = 0; i < 2; i++)
   {
-    file_array[i] = blank;
+    file = (file_t *) kmem_cache_alloc(&file_cache);
+    if (file == NULL)
+      return -1;
+    file->file_ops_table_ptr = (int32_t) terminal_ops;
+    file->inode_num = 0;
+    file->file_position = 0;
+    file->flags = FILE_OCCUP;
+    file->refcount = 1;
+    fd_table->files[i] = file;
+    fd_table->open_map[0] |= 1 << i;
   }
+  return 0;
+}
+
+/* clone_fd_table
+ * DESCRIPTION: gives a forked child the same descriptors as its parent, both
+ *              share every open file including its offset
+ * INPUTS: the child's zeroed table, the parent's table
+ * OUTPUTS: fills in the child's table
+ * RETURN VALUE: 0 on success, -1 if out of memory
+ * SIDE EFFECTS: takes a reference to every open file
+ */
+int32_t clone_fd_table(fd_table_t * child, const fd_table_t * parent)
+{
+  uint32_t i;
+
+  child->files = (file_t **) kmalloc(parent->size * sizeof(file_t *));
+  if (child->files == NULL)
+    return -1;
+  memcpy(child->files, parent->files, parent->size * sizeof(file_t *));
+  memcpy(child->open_map, parent->open_map, sizeof(parent->open_map));
+  child->size = parent->size;
 
-  // stdin
-  file_array[0].file_ops_table_ptr = (int32_t) terminal_ops;
-  file_array[0].inode_num = 0;
-  file_array[0].file_position = 0;
-  file_array[0].flags = FILE_OCCUP;
+  for (i = 0; i < child->size; i++){
+    if (child->files[i] != NULL)
+      child->files[i]->refcount++;
+  }
+  return 0;
+}
 
-  // stdout
-  file_array[1].file_ops_table_ptr = (int32_t) terminal_ops;
-  file_array[1].inode_num = 0;
-  file_array[1].file_position = 0;
-  file_array[1].flags = FILE_OCCUP;
+/* release_fd_table
+ * DESCRIPTION: frees every file still open in a descriptor table and the
+ *              table itself, without calling their close functions (used when
+ *              tearing a process down)
+ * INPUTS: descriptor table of a process
+ * OUTPUTS: leaves the table empty
+ * RETURN VALUE: none
+ * SIDE EFFECTS: none
+ */
+void release_fd_table(fd_table_t * fd_table)
+{
+  uint32_t i;
+  for (i = 0; i < fd_table->size; i++)
+  {
+    if (fd_table->files[i] != NULL)
+      put_file(fd_table->files[i]);
+  }
+  kfree(fd_table->files);
+  fd_table->files = NULL;
+  fd_table->size = 0;
+  memset(fd_table->open_map, 0, sizeof(fd_table->open_map));
 }
@@ -5,13 +5,37 @@
 #include "lib.h"
 #include "rtc.h"
 #include "pcb.h"
+#include "slab.h"
+#include "block_cache.h"
 
 #define FILENAME_LEN 32
 #define NUM_FILES 63
+// longest path open, creat and execute take, and most directories a path can go down
+#define MAX_PATH_LEN 128
+#define MAX_PATH_DEPTH 16
+// inode number standing for the root directory, which lives in the boot block
+// instead of an inode. Other directories are inodes holding an array of dentry_t
+#define ROOT_DIR_INODE (-1)
+// directory entries read at a time when a subdirectory is searched
+#define DIR_SCAN_ENTRIES 8
 #define NUM_B_IN_FOUR_KB 4096
+#define MAX_INODE_BLOCKS 1023
+#define MAX_FILE_SIZE (MAX_INODE_BLOCKS * NUM_B_IN_FOUR_KB)
+// entries in a file ops table: open, read, write, close, pread, pwrite, getdents, ioctl
+#define NUM_FILE_OPS 8
 #define FILE_AVAIL 1
 #define FILE_OCCUP 0
 
+// buckets in the root directory's hash index and slots in the dcache, powers of 2
+#define DENTRY_HASH_SIZE 128
+#define DCACHE_SIZE 256
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+
+// ELF header size and the offset of the entry point in it
+#define ELF_HEADER_SIZE 52
+#define ELF_ENTRY 24
+
 extern int32_t file_open(const uint8_t* filename);
 
 extern int32_t file_close(int32_t fd);
@@ -20,6 +44,10 @@ extern int32_t file_read(int32_t fd, int8_t* buf, int32_t nbytes);
 
 extern int32_t file_write(int32_t fd, const int8_t* buf, int32_t nbytes);
 
+extern int32_t file_pread(int32_t fd, int8_t* buf, int32_t nbytes, uint32_t offset);
+
+extern int32_t file_pwrite(int32_t fd, const int8_t* buf, int32_t nbytes, uint32_t offset);
+
 extern int32_t directory_open(const uint8_t* filename);
 
 extern int32_t directory_close(int32_t fd);
@@ -28,6 +56,8 @@ extern int32_t directory_read(int32_t fd, int8_t* buf, int32_t nbytes);
 
 extern int32_t directory_write(int32_t fd, const int8_t* buf, int32_t nbytes);
 
+extern int32_t directory_getdents(int32_t fd, void* buf, int32_t nbytes);
+
 //struct field names taken from lecture notes
 //64 bytes total
 typedef struct dentry_t{
@@ -46,22 +76,89 @@ typedef struct boot_block_t{
 	dentry_t direntries[63];
 } boot_block_t;
 
+//one entry returned by getdents, records are packed back to back and padded to 4 bytes
+typedef struct dirent_t{
+	uint16_t reclen;	// bytes in this record, including the name and padding
+	uint8_t type;		// file type from the directory entry
+	uint8_t namelen;	// name length without the NUL
+	uint32_t inode;
+	uint32_t size;		// length of a regular file, 0 for anything else
+	int8_t name[FILENAME_LEN + 1];	// NUL terminated, only namelen + 1 bytes (rounded up) are filled
+} dirent_t;
+#define DIRENT_HEADER_SIZE 12
+
 //4096 bytes total
 typedef struct inode_t{
 	int32_t length;
-	int32_t data_block_num[1023];
+	int32_t data_block_num[MAX_INODE_BLOCKS];
 } inode_block_t;
 
+// a run of a file's blocks that sit in consecutive data blocks of the image
+typedef struct extent_t{
+	uint32_t file_block;	// index in data_block_num of the first block
+	uint32_t data_block;	// data block number of the first block
+	uint32_t count;		// number of blocks in the run
+} extent_t;
+
+// where an inode's reads stopped, to tell sequential reads that are worth reading ahead for
+typedef struct read_ahead_t{
+	uint32_t next_offset;	// offset just past the last read_data, a read starting there is sequential
+	uint32_t ahead_end;	// index of the first block not read ahead yet
+} read_ahead_t;
+
+// every extent of one inode, in file order
+typedef struct extent_table_t{
+	uint32_t count;
+	extent_t * extents;
+} extent_table_t;
+
 extern int32_t read_dentry_by_name(const uint8_t* fname, dentry_t* dentry);
 
 extern int32_t read_dentry_by_index(uint32_t index, dentry_t* dentry);
 
+extern void build_dentry_index(void);
+
+extern int32_t open_dentry(const dentry_t* dentry);
+
+extern int32_t create_file(const uint8_t* path, int32_t filetype);
+
+extern int32_t truncate_file(uint32_t inode);
+
+extern int32_t build_extent_table(uint32_t inode);
+
 extern int32_t read_data(uint32_t inode, uint32_t offset, uint8_t* buf, uint32_t length);
 
-extern void init_vfs(uint32_t ptr);
+extern int32_t write_data(uint32_t inode, uint32_t offset, const uint8_t* buf, uint32_t length);
+
+extern void init_vfs(block_device_t* dev);
+
+extern int32_t open_program(const uint8_t* filename, program_image_t* image);
+
+extern uint8_t* file_page_address(uint32_t inode, uint32_t size, uint32_t offset);
+
+extern int32_t read_file_page(uint32_t inode, uint32_t size, uint32_t offset, uint8_t* page);
+
+extern int32_t file_size(file_t* file);
+
+extern uint8_t* program_page_address(const program_image_t* image, uint32_t offset);
+
+extern int32_t read_program_page(const program_image_t* image, uint32_t offset, uint8_t* page);
+
+extern int32_t install_file(file_t * file);
+
+extern file_t * remove_file(int32_t fd);
+
+extern int32_t init_fd_table(fd_table_t * fd_table);
+
+extern int32_t clone_fd_table(fd_table_t * child, const fd_table_t * parent);
+
+extern void release_fd_table(fd_table_t * fd_table);
+
+extern file_t * get_file(int32_t fd);
 
-extern int32_t load_program(const uint8_t* filename, uint8_t * ptr);
+extern void put_file(file_t * file);
 
-extern void init_file_array(file_t *file_array);
+// slab cache the open files are allocated from
+extern kmem_cache_t file_cache;
 
 #endif
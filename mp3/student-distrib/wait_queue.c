@@ -0,0 +1,70 @@
+#include "wait_queue.h"
+#include "scheduler.h"
+
+/*
+ * init_wait_queue
+ *   DESCRIPTION: empties a wait queue
+ *   INPUTS: queue - the wait queue to initialize
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: modifies the queue
+ */
+void init_wait_queue(wait_queue_t *queue){
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+/*
+ * sleep_on
+ *   DESCRIPTION: blocks the current process on a wait queue and gives up the CPU.
+ *                Callers should test their wake-up condition with interrupts
+ *                disabled and call this in a loop, otherwise a wake up that
+ *                happens between the test and the sleep is lost.
+ *   INPUTS: queue - the wait queue to sleep on
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: marks the process blocked, runs other processes until woken up
+ */
+void sleep_on(wait_queue_t *queue){
+    uint32_t flags;
+    pcb_t * pcb = getCurrentProcessPCB();
+
+    cli_and_save(flags);
+    pcb->state = TASK_BLOCKED;
+    pcb->next_waiting = 0;
+    if(queue->tail == 0)
+        queue->head = curr_process;
+    else
+        getProcessPCB(queue->tail)->next_waiting = curr_process;
+    queue->tail = curr_process;
+
+    yield();    //Returns once wake_up has put us back in the run queue and we get picked
+    restore_flags(flags);
+}
+
+/*
+ * wake_up
+ *   DESCRIPTION: moves every process sleeping on a wait queue to the run queue.
+ *                Safe to call from interrupt handlers.
+ *   INPUTS: queue - the wait queue to wake
+ *   OUTPUTS: none
+ *   RETURN VALUE: none
+ *   SIDE EFFECTS: empties the queue, modifies the run queue
+ */
+void wake_up(wait_queue_t *queue){
+    uint32_t flags, pid, next_pid;
+    pcb_t * pcb;
+
+    cli_and_save(flags);
+    pid = queue->head;
+    while(pid != 0){
+        pcb = getProcessPCB(pid);
+        next_pid = pcb->next_waiting;
+        pcb->next_waiting = 0;
+        if(pcb->state == TASK_BLOCKED)
+            enqueue_task(pid);
+        pid = next_pid;
+    }
+    init_wait_queue(queue);
+    restore_flags(flags);
+}
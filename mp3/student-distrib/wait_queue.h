@@ -0,0 +1,25 @@
+#ifndef WAIT_QUEUE_H_
+#define WAIT_QUEUE_H_
+
+#include "types.h"
+
+/*
+ * A FIFO of processes sleeping until some event happens (an RTC tick, a key
+ * press, ...). Processes are linked through next_waiting in their PCBs, so the
+ * queue itself is just a head and tail PID, 0 meaning empty.
+ */
+typedef struct wait_queue_t {
+    uint32_t head;
+    uint32_t tail;
+} wait_queue_t;
+
+/* This method empties a wait queue */
+void init_wait_queue(wait_queue_t *queue);
+
+/* This method blocks the current process on a wait queue until woken up */
+void sleep_on(wait_queue_t *queue);
+
+/* This method makes every process on a wait queue ready to run again */
+void wake_up(wait_queue_t *queue);
+
+#endif
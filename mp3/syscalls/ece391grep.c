@@ -4,19 +4,52 @@
 #include "ece391syscall.h"
 
 #define BUFSIZE 1024
-#define SBUFSIZE 33
+
+/* print "fname:line\n" with a single system call */
+void
+print_match (const char* fname, const uint8_t* line, int32_t len)
+{
+    ece391_iovec_t iov[4];
+
+    iov[0].base = (void*)fname;
+    iov[0].len = ece391_strlen ((uint8_t*)fname);
+    iov[1].base = ":";
+    iov[1].len = 1;
+    iov[2].base = (void*)line;
+    iov[2].len = len;
+    iov[3].base = "\n";
+    iov[3].len = 1;
+    ece391_writev (1, iov, 4);
+}
+
+void
+grep_mapped (const char* s, const char* fname, const uint8_t* data, int32_t size)
+{
+    int32_t line_start, line_end, check, s_len;
+
+    s_len = ece391_strlen ((uint8_t*)s);
+    for (line_start = 0; line_start < size; line_start = line_end + 1) {
+	line_end = line_start;
+	while (line_end < size && '\n' != data[line_end])
+	    line_end++;
+	/* search the line */
+	for (check = line_start; check + s_len <= line_end; check++) {
+	    if (s[0] == data[check] &&
+		0 == ece391_strncmp ((uint8_t*)(data + check), (uint8_t*)s, s_len)) {
+		print_match (fname, data + line_start, line_end - line_start);
+		break;
+	    }
+	}
+    }
+}
 
 int32_t
-do_one_file (const char* s, const char* fname) 
+grep_read (const char* s, const char* fname, int32_t fd)
 {
-    int32_t fd, cnt, last, line_start, line_end, check, s_len;
+    int32_t cnt, last, line_start, line_end, check, s_len;
     uint8_t data[BUFSIZE+1];
 
     s_len = ece391_strlen ((uint8_t*)s);
-    if (-1 == (fd = ece391_open ((uint8_t*)fname))) {
-        ece391_fdputs (1, (uint8_t*)"file open failed\n");
-        return -1;
-    }
     last = 0;
     while (1) {
         cnt = ece391_read (fd, data + last, BUFSIZE - last);
@@ -42,10 +75,7 @@ do_one_file (const char* s, const char* fname)
 	    for (check = line_start; check < line_end; check++) {
 		if (s[0] == data[check] && 
 		    0 == ece391_strncmp ((uint8_t*)(data + check), (uint8_t*)s, s_len)) {
-		    ece391_fdputs (1, (uint8_t*)fname);
-		    ece391_fdputs (1, (uint8_t*)":");
-		    ece391_fdputs (1, data + line_start);
-		    ece391_fdputs (1, (uint8_t*)"\n");
+		    print_match (fname, data + line_start, ece391_strlen (data + line_start));
 		    break;
 		}
 	    }
@@ -58,6 +88,26 @@ do_one_file (const char* s, const char* fname)
 	if (0 == cnt)
 	    break;
     }
+    return 0;
+}
+
+int32_t
+do_one_file (const char* s, const char* fname) 
+{
+    int32_t fd, size;
+    uint8_t* data;
+
+    if (-1 == (fd = ece391_open ((uint8_t*)fname))) {
+        ece391_fdputs (1, (uint8_t*)"file open failed\n");
+        return -1;
+    }
+    /* scan the file in place when it can be mapped, otherwise read it in pieces */
+    if (-1 != (size = ece391_mmap (fd, &data))) {
+	grep_mapped (s, fname, data, size);
+	ece391_munmap (data);
+    } else if (-1 == grep_read (s, fname, fd)) {
+	return -1;
+    }
     if (-1 == ece391_close (fd)) {
         ece391_fdputs (1, (uint8_t*)"file close failed\n");
         return -1;
@@ -67,9 +117,10 @@ do_one_file (const char* s, const char* fname)
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, pos;
+    uint32_t dbuf[BUFSIZE / 4];     /* dirent records are 4-byte aligned */
     uint8_t search[BUFSIZE];
+    ece391_dirent_t* d;
 
     if (0 != ece391_getargs (search, BUFSIZE)) {
         ece391_fdputs (1, (uint8_t*)"could not read argument\n");
@@ -81,16 +132,18 @@ int main ()
 	return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    while (0 != (cnt = ece391_getdents (fd, dbuf, BUFSIZE))) {
         if (-1 == cnt) {
 	    ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	    return 3;
 	}
-	if ('.' == buf[0]) /* a directory... */
-	    continue;
-	buf[cnt] = '\0';
-	if (0 != do_one_file ((char*)search, (char*)buf))
-	    return 3;
+	for (pos = 0; pos < cnt; pos += d->reclen) {
+	    d = (ece391_dirent_t*)((uint8_t*)dbuf + pos);
+	    if (2 != d->type || 0 == d->size) /* directories, devices, empty files */
+		continue;
+	    if (0 != do_one_file ((char*)search, d->name))
+		return 3;
+	}
     }
 
     return 0;
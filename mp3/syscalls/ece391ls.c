@@ -3,25 +3,40 @@
 #include "ece391support.h"
 #include "ece391syscall.h"
 
-#define SBUFSIZE 33
+#define DBUFSIZE 1024
+#define PATHSIZE 129
 
 int main ()
 {
-    int32_t fd, cnt;
-    uint8_t buf[SBUFSIZE];
+    int32_t fd, cnt, pos, len, i;
+    uint32_t dbuf[DBUFSIZE / 4];    /* dirent records are 4-byte aligned */
+    uint8_t out[DBUFSIZE];          /* a name and newline never outgrow its record */
+    uint8_t path[PATHSIZE];
+    ece391_dirent_t* d;
 
-    if (-1 == (fd = ece391_open ((uint8_t*)"."))) {
+    /* list the directory named on the command line, or the root */
+    if (0 != ece391_getargs (path, PATHSIZE))
+        ece391_strcpy (path, (uint8_t*)".");
+
+    if (-1 == (fd = ece391_open (path))) {
         ece391_fdputs (1, (uint8_t*)"directory open failed\n");
         return 2;
     }
 
-    while (0 != (cnt = ece391_read (fd, buf, SBUFSIZE-1))) {
+    /* one getdents and one write per batch of entries */
+    while (0 != (cnt = ece391_getdents (fd, dbuf, DBUFSIZE))) {
         if (-1 == cnt) {
 	        ece391_fdputs (1, (uint8_t*)"directory entry read failed\n");
 	        return 3;
 	    }
-	    buf[cnt] = '\n';
-	    if (-1 == ece391_write (1, buf, cnt + 1))
+	    len = 0;
+	    for (pos = 0; pos < cnt; pos += d->reclen) {
+	        d = (ece391_dirent_t*)((uint8_t*)dbuf + pos);
+	        for (i = 0; i < d->namelen; i++)
+	            out[len++] = d->name[i];
+	        out[len++] = '\n';
+	    }
+	    if (-1 == ece391_write (1, out, len))
 	        return 3;
     }
 